@@ -0,0 +1,102 @@
+// microbenchmark for the manager's pid index: keeps N live jobs in it, with pids handed out
+// in order the way the kernel does, and times looking them up, looking up pids that are not
+// ours, and a job exiting while another one starts.
+//
+//   ../bin/bench_pid_index [jobs] [ops]    defaults 1000 10000 100000 jobs, 10000000 ops
+
+#define main processmanager_main
+#include "processmanager.c"
+#undef main
+
+enum {
+    ARG_JOBS = 1,
+    ARG_OPS = 2,
+    DEFAULT_OPS = 10000000,
+    FIRST_PID = 1000
+};
+
+uint64_t bench_state = 88172645463325252ULL;
+
+// xorshift, cheap next to what is being measured
+size_t random_below(size_t n)
+{
+    bench_state ^= bench_state << 13;
+    bench_state ^= bench_state >> 7;
+    bench_state ^= bench_state << 17;
+    return (size_t)(bench_state % n);
+}
+
+double ns_per_op(int64_t started, int ops)
+{
+    return (double)(monotonic_ns() - started) / ops;
+}
+
+void run_benchmark(int jobs, int ops)
+{
+    process_record* const records = (process_record*)calloc((size_t)jobs, sizeof(process_record));
+    if (records == NULL) {
+        fprintf(stderr, "unable to allocate %d records\n", jobs);
+        exit(EXIT_FAILURE);
+    }
+    pid_t next_pid = FIRST_PID;
+    for (int i = 0; i < jobs; i++) {
+        records[i].pid = next_pid++;
+        pid_index_insert(&records[i]);
+    }
+
+    // every lookup is checked so none of them can be optimised away
+    size_t found = 0;
+    int64_t started = monotonic_ns();
+    for (int i = 0; i < ops; i++) {
+        found += pid_index_find(records[random_below((size_t)jobs)].pid) != NULL;
+    }
+    const double hit = ns_per_op(started, ops);
+
+    // SIGCHLD for helpers and adopted processes, whose pids are not in the index
+    started = monotonic_ns();
+    for (int i = 0; i < ops; i++) {
+        found += pid_index_find(next_pid + (pid_t)random_below((size_t)jobs)) != NULL;
+    }
+    const double miss = ns_per_op(started, ops);
+
+    // a random job is reaped and the next one spawned takes the next pid
+    started = monotonic_ns();
+    for (int i = 0; i < ops; i++) {
+        process_record* const p = &records[random_below((size_t)jobs)];
+        pid_index_remove(p);
+        p->pid = next_pid++;
+        pid_index_insert(p);
+    }
+    const double churn = ns_per_op(started, ops);
+
+    if (found != (size_t)ops || pid_index_count != (size_t)jobs) {
+        fprintf(stderr, "the pid index lost track of its jobs\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("%d jobs: find %.1f ns, find missing %.1f ns, reap and spawn %.1f ns\n", jobs, hit, miss, churn);
+}
+
+int main(int argc, char* argv[])
+{
+    const int ops = argc > ARG_OPS ? atoi(argv[ARG_OPS]) : DEFAULT_OPS;
+    if ((argc > ARG_JOBS && atoi(argv[ARG_JOBS]) <= 0) || ops <= 0) {
+        fprintf(stderr, "usage: %s [jobs] [ops]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > ARG_JOBS) {
+        run_benchmark(atoi(argv[ARG_JOBS]), ops);
+        return EXIT_SUCCESS;
+    }
+    // each table size in a fresh process, so one run's index does not slow the next
+    const int sizes[] = { 1000, 10000, 100000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fflush(stdout);
+        const pid_t child = fork();
+        if (child == 0) {
+            run_benchmark(sizes[i], ops);
+            return EXIT_SUCCESS;
+        }
+        waitpid(child, NULL, 0);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+// spawn rate of the ways a job can start: fork as the manager used to, with the parent
+// SIGSTOPping the child, spawn_job straight into a free slot, and spawn_job held until its
+// SIGCONT. Every job is /bin/true, released and reaped before the next one, with SIGCHLD
+// blocked as in the manager. The heap is dirtied first, which fork pays to copy.
+//
+//   ../bin/bench_spawn [jobs] [heap_mb]    defaults 2000 jobs, 0 64 256 MB
+
+#define main processmanager_main
+#include "processmanager.c"
+#undef main
+
+enum {
+    ARG_JOBS = 1,
+    ARG_HEAP_MB = 2,
+    DEFAULT_JOBS = 2000
+};
+
+// spawn_job runs programs relative to the working directory
+char* true_args[] = { "bin/true", NULL };
+
+pid_t fork_stopped(void)
+{
+    const pid_t pid = fork();
+    if (pid == 0) {
+        execv("/bin/true", true_args);
+        _exit(EXIT_FAILURE);
+    }
+    kill(pid, SIGSTOP);
+    return pid;
+}
+
+// jobs per second
+double spawn_rate(int jobs, int mode)
+{
+    const int64_t started = monotonic_ns();
+    for (int i = 0; i < jobs; i++) {
+        int output_fd;
+        const pid_t pid = mode == 0 ? fork_stopped() : spawn_job(true_args, mode == 2, &output_fd);
+        if (pid == -1) {
+            fprintf(stderr, "unable to start /bin/true: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (mode != 1) {
+            kill(pid, SIGCONT);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return jobs / ((double)(monotonic_ns() - started) / 1e9);
+}
+
+void run_benchmark(int jobs, int heap_mb)
+{
+    const size_t size = (size_t)heap_mb << 20;
+    char* const heap = (char*)malloc(size + 1);
+    if (heap == NULL) {
+        fprintf(stderr, "unable to allocate %d MB\n", heap_mb);
+        exit(EXIT_FAILURE);
+    }
+    memset(heap, 1, size + 1);
+    printf("%4d MB   %6.0f jobs/s   %6.0f jobs/s   %6.0f jobs/s\n", heap_mb, spawn_rate(jobs, 0),
+        spawn_rate(jobs, 1), spawn_rate(jobs, 2));
+    free(heap);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && strcmp(argv[0], hold_argv0) == 0) {
+        return hold_and_exec(&argv[1]);
+    }
+    const int jobs = argc > ARG_JOBS ? atoi(argv[ARG_JOBS]) : DEFAULT_JOBS;
+    if (jobs <= 0 || (argc > ARG_HEAP_MB && atoi(argv[ARG_HEAP_MB]) < 0) || chdir("/") == -1) {
+        fprintf(stderr, "usage: %s [jobs] [heap_mb]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    printf("heap      fork+SIGSTOP   posix_spawn    posix_spawn held\n");
+    if (argc > ARG_HEAP_MB) {
+        run_benchmark(jobs, atoi(argv[ARG_HEAP_MB]));
+        return EXIT_SUCCESS;
+    }
+    const int sizes[] = { 0, 64, 256 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fflush(stdout);
+        run_benchmark(jobs, sizes[i]);
+    }
+    return EXIT_SUCCESS;
+}
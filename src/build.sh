@@ -5,12 +5,18 @@ BIN="../bin/"
 mkdir -p ${BIN}
 
 rm ${BIN}processmanager
+rm ${BIN}client
 rm ${BIN}clock
 rm ${BIN}pr
 rm ${BIN}execpractice.c
+rm ${BIN}bench_pid_index
+rm ${BIN}bench_spawn
 
 $GCC ${BIN}processmanager processmanager.c
+$GCC ${BIN}client client.c
 $GCC ${BIN}clock clock.c
 $GCC ${BIN}pr pr.c
 $GCC ${BIN}shell shell.c
-$GCC ${BIN}execpractice execpractice.c
\ No newline at end of file
+$GCC ${BIN}execpractice execpractice.c
+$GCC ${BIN}bench_pid_index bench_pid_index.c
+$GCC ${BIN}bench_spawn bench_spawn.c
\ No newline at end of file
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+// sends commands to a process manager started with -s and prints its replies.
+// With a command on the command line just that one is sent, otherwise every line of
+// stdin is sent without waiting for replies in between. Replies to failed commands go
+// to stderr and make the exit status non-zero. After a watch command on the command line
+// the job events keep being printed until the manager goes away.
+
+enum {
+    ARG_SOCKET = 1,
+    ARG_COMMAND = 2
+};
+
+int connect_to_manager(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// encodes and sends one command, false if the words are not one or the manager is gone
+bool send_words(int fd, char* words[], int count, uint32_t request_id, char** message, size_t* capacity)
+{
+    const command_name* const cmd = find_command(words[0]);
+    if (cmd == NULL) {
+        fprintf(stderr, "unknown command %s\n", words[0]);
+        return false;
+    }
+    const uint32_t length = encode_command(cmd, request_id, words, count, message, capacity);
+    if (length == 0) {
+        fprintf(stderr, "command is too long\n");
+        return false;
+    }
+    if (!write_all(fd, *message, length)) {
+        fprintf(stderr, "unable to write to the manager\n");
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+// sends every line of stdin, returns how many commands went out
+uint32_t send_lines(int fd, bool* failed)
+{
+    char* line = NULL;
+    size_t line_capacity = 0;
+    char** words = NULL;
+    size_t words_capacity = 0;
+    char* message = NULL;
+    size_t message_capacity = 0;
+    uint32_t sent = 0;
+
+    while (getline(&line, &line_capacity, stdin) != -1) {
+        int count = 0;
+        char* save = NULL;
+        for (char* word = strtok_r(line, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save)) {
+            if ((size_t)count + 1 >= words_capacity) {
+                words_capacity = words_capacity == 0 ? 16 : words_capacity * 2;
+                words = (char**)realloc(words, words_capacity * sizeof(char*));
+                if (words == NULL) {
+                    fprintf(stderr, "unable to grow the argument list\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            words[count++] = word;
+        }
+        if (count == 0) {
+            continue;
+        }
+        if (send_words(fd, words, count, sent + 1, &message, &message_capacity)) {
+            sent++;
+        } else {
+            *failed = true;
+        }
+    }
+    free(line);
+    free(words);
+    free(message);
+    return sent;
+}
+
+// prints replies until every command sent has been answered, false if the manager went away first.
+// With follow, notifications keep being printed after that until the manager goes away
+bool read_replies(int fd, uint32_t expected, bool follow, bool* failed)
+{
+    char* buffer = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    uint32_t answered = 0;
+
+    while (answered < expected || follow) {
+        if (capacity - length < 4096) {
+            capacity = capacity == 0 ? 65536 : capacity * 2;
+            buffer = (char*)realloc(buffer, capacity);
+            if (buffer == NULL) {
+                fprintf(stderr, "unable to grow the reply buffer\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        const ssize_t n = read(fd, buffer + length, capacity - length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        length += (size_t)n;
+
+        size_t offset = 0;
+        while (length - offset >= sizeof(reply_header)) {
+            reply_header header;
+            memcpy(&header, buffer + offset, sizeof(header));
+            if (length - offset < header.length) {
+                break;
+            }
+            const bool ok = header.status == REPLY_OK;
+            fputs(buffer + offset + sizeof(header), ok ? stdout : stderr);
+            *failed = *failed || !ok;
+            answered += header.request_id != 0;
+            offset += header.length;
+        }
+        length -= offset;
+        memmove(buffer, buffer + offset, length);
+        if (follow) {
+            fflush(stdout);
+        }
+    }
+    free(buffer);
+    return answered == expected;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < ARG_COMMAND) {
+        fprintf(stderr, "usage: %s socket_path [command [args...]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const int fd = connect_to_manager(argv[ARG_SOCKET]);
+    if (fd == -1) {
+        fprintf(stderr, "unable to connect to %s: %s\n", argv[ARG_SOCKET], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    bool failed = false;
+    uint32_t sent = 0;
+    const bool follow = argc > ARG_COMMAND && strcmp(argv[ARG_COMMAND], "watch") == 0
+        && (argc == ARG_COMMAND + 1 || strcmp(argv[ARG_COMMAND + 1], "off") != 0);
+    if (argc > ARG_COMMAND) {
+        char* message = NULL;
+        size_t message_capacity = 0;
+        if (send_words(fd, &argv[ARG_COMMAND], argc - ARG_COMMAND, 1, &message, &message_capacity)) {
+            sent = 1;
+        } else {
+            failed = true;
+        }
+        free(message);
+    } else {
+        sent = send_lines(fd, &failed);
+    }
+
+    if (!read_replies(fd, sent, follow && sent == 1, &failed)) {
+        fprintf(stderr, "the manager went away before answering\n");
+        failed = true;
+    }
+    close(fd);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
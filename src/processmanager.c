@@ -1,13 +1,38 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
 #include <signal.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/pidfd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "protocol.h"
+
 /******************************************************************************
  * Types
  ******************************************************************************/
@@ -17,511 +42,4807 @@ typedef enum process_status {
     READY = 1,
     STOPPED = 2,
     TERMINATED = 3,
-    UNUSED = 4
+    UNUSED = 4,
+    WAITING = 5 // run -d: held until every job it depends on has exited successfully
 } process_status;
 
+// one argument of a job array: a literal, a range a..b or a list {x,y,z}
+typedef struct array_argument {
+    char* text; // the literal, or the list values one after another, NUL separated
+    char** values; // list values pointing into text, NULL for literals and ranges
+    long first; // range start
+    size_t count; // values this argument takes, 1 for a literal
+} array_argument;
+
+// tasks of a job array, every combination of its arguments' values with the last varying fastest
+typedef struct job_array {
+    array_argument* args;
+    int argc;
+    size_t next; // task to start next
+    size_t count;
+    // the arguments as given, NUL separated, for the journal
+    char* source;
+    size_t source_length;
+} job_array;
+
+// what a job and every descendant it left behind used, from wait4 as each is reaped
+typedef struct process_usage {
+    int64_t start_ns; // monotonic, when it was spawned
+    int64_t end_ns; // monotonic, when the last of its process group was reaped, 0 while alive
+    bool exited; // the job's own process has been reaped, helpers it forked may still run
+    int exit_status; // raw wait status of the job's own process
+    int descendants; // orphaned helpers we reaped for it as subreaper
+    int64_t user_us;
+    int64_t system_us;
+    long max_rss_kb;
+    long voluntary_switches;
+    long involuntary_switches;
+    long blocks_in;
+    long blocks_out;
+} process_usage;
+
+// a live job as sampled from /proc/<pid>/stat
+typedef struct process_sample {
+    char state;
+    int64_t user_us;
+    int64_t system_us;
+    long rss_kb;
+    long threads;
+    long minor_faults;
+    long major_faults;
+    uint64_t start_ticks; // clock ticks after boot the process started, tells a reused pid apart
+} process_sample;
+
+enum {
+    // log-linear buckets: exact below 16 ns, then 16 per power of two, ~6% wide
+    HISTOGRAM_SUB_BITS = 4,
+    HISTOGRAM_BUCKETS = (64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS,
+    // buckets exported to Prometheus: every power of two from 2^10 ns (about 1 us) to 2^37 ns (about 137 s)
+    EXPORT_FIRST_SHIFT = 10,
+    EXPORT_LAST_SHIFT = 37
+};
+
+// latencies in nanoseconds, recording is a count leading zeros and an increment
+typedef struct latency_histogram {
+    const char* name;
+    const char* help;
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} latency_histogram;
+
+typedef enum trace_type {
+    TRACE_SPAWN, // arg: 1 when spawned held
+    TRACE_CONTINUE, // SIGCONT into a slot, arg: status it left
+    TRACE_PREEMPT, // SIGSTOP back to the queue, arg: 1 to the front of its priority, 0 slice expired
+    TRACE_STOP, // SIGSTOP from the stop command
+    TRACE_KILL, // arg: SIGTERM or SIGKILL
+    TRACE_REAP, // arg: wait status
+    TRACE_SIGNAL // any other signal sent outside the transitions above, arg: the signal
+} trace_type;
+
+typedef struct trace_event {
+    int64_t ns; // monotonic
+    pid_t pid;
+    int16_t type; // trace_type
+    int16_t slot; // running slot involved, -1 if none
+    int32_t arg;
+} trace_event;
+
+// run --timeout, --cpu-limit and --deadline, in ns and 0 where not given
+typedef struct job_limits {
+    int64_t timeout_ns; // wall time from when the job first runs
+    int64_t cpu_limit_ns; // cpu time of the job and the helpers it has had reaped
+    int64_t deadline_ns; // monotonic, when the job should have finished by
+} job_limits;
+
+// a team or tenant sharing the manager, its jobs get slots in proportion to its weight
+typedef struct job_group {
+    char* name;
+    int weight;
+    int64_t pass; // virtual time its next queued job starts at
+    int64_t slot_ns; // time its jobs have held slots
+    // totals of its reaped jobs, from their rusage
+    size_t finished;
+    int64_t user_us;
+    int64_t system_us;
+} job_group;
+
 typedef struct process_record {
     pid_t pid;
     int index;
+    int running_index; // slot in running_processes, -1 when not running
     process_status status;
+    int priority; // higher runs first, set with run -p or priority
+    // tie-break within a priority: queue order while READY, start order while RUNNING
+    int64_t sequence;
+    // run -g: index into groups, and the virtual time the job starts at in its group's stride
+    int group;
+    int64_t fair_tag;
+    // the stride its group was charged for its current turn, and how long it has held a slot since
+    int64_t fair_charge;
+    int64_t fair_run_ns;
+    size_t heap_index; // position in process_queue or running_heap
+    int64_t slice_end; // monotonic ns when the round robin quantum of a running job runs out
+    // -m: feedback level, 0 until the job uses whole slices, and its cpu time when its slice began
+    int level;
+    int64_t slice_cpu_ns;
+    int64_t status_since; // monotonic ns of the last change of status
+    // set on the queued placeholder of a job array, which has no pid of its own
+    job_array* array;
+    process_usage usage;
+    // run -d: parents still to succeed before this WAITING job is queued, and the jobs waiting on this one
+    int unmet_parents;
+    struct process_record** dependents;
+    size_t dependent_count;
+    size_t dependent_capacity;
+    // with -l: the job's stdout and stderr pipe, open until every writer has closed it,
+    // and the log it is spliced into
+    int output_fd;
+    int log_fd;
+    int64_t log_bytes;
+    // -J: when the job's process started, and for a job adopted from the journal after a restart,
+    // the pidfd we learn of its exit from since it is no longer our child
+    uint64_t start_ticks;
+    bool adopted;
+    int pidfd;
+    // limits the job runs under, when it first ran, when its cpu is next due to be checked and,
+    // once it was sent SIGTERM for a limit, when it gets SIGKILL
+    job_limits limits;
+    int64_t first_run_ns;
+    int64_t cpu_check_ns;
+    int64_t kill_at_ns;
+    bool deadline_missed;
+    // place on the timer wheel: when it is due, 0 while not on it, and the bucket's list
+    int64_t timer_ns;
+    size_t timer_bucket;
+    struct process_record* timer_prev;
+    struct process_record* timer_next;
+    // links for whichever list the record is on: history or free list
+    struct process_record* prev;
+    struct process_record* next;
 } process_record;
 
+// binary heap of records, each record remembers its position for O(log n) updates
+typedef struct process_heap {
+    process_record** items;
+    size_t length;
+    size_t capacity;
+    // true when a should be closer to the top than b
+    bool (*before)(const process_record* a, const process_record* b);
+} process_heap;
+
+// the terminal end of the connection to the manager
+typedef struct terminal {
+    int input_fd; // stdin, or the -b script
+    bool prompt; // false in batch mode
+    int writing_pipe;
+    int reply_pipe;
+    struct command_ring* ring;
+    // stdin bytes not yet split into lines
+    char* input;
+    size_t input_length;
+    size_t input_capacity;
+    char** words;
+    size_t words_capacity;
+    char* message;
+    size_t message_capacity;
+    // reply bytes not yet making up a whole reply
+    char* replies;
+    size_t replies_length;
+    size_t replies_capacity;
+    uint32_t next_request_id;
+    uint32_t exit_request_id; // 0 unless an exit is waiting for its reply
+    bool input_done; // end of input, or the manager went away
+    bool exit_at_eof; // false while socket clients may still want the manager
+} terminal;
+
+// something the manager takes commands from and sends replies to: its terminal or a socket client
+typedef struct client {
+    int in_fd;
+    int out_fd; // the same socket as in_fd, except for the terminal's pair of pipes
+    size_t slot; // position in clients, also tags its epoll events
+    // bytes read that do not yet form a whole message
+    char* in;
+    size_t in_length;
+    size_t in_capacity;
+    // replies out_fd could not take yet, they go out on EPOLLOUT
+    char* out;
+    size_t out_length;
+    size_t out_capacity;
+    bool out_watched;
+    bool watching; // sent watch, job events are streamed to it as they happen
+} client;
+
+enum {
+    COMMAND_RING_SIZE = 1 << 20
+};
+_Static_assert(MAX_COMMAND_SIZE <= COMMAND_RING_SIZE / 2, "a command must fit in the ring");
+
+// single-producer/single-consumer byte ring shared by the terminal and the manager
+// across the fork. Each message is a uint32_t length followed by that many bytes;
+// head and tail only ever grow and are masked into data.
+typedef struct command_ring {
+    _Atomic uint64_t head; // advanced by the terminal
+    _Atomic int producer_waiting;
+    _Alignas(64) _Atomic uint64_t tail; // advanced by the manager
+    _Atomic int consumer_sleeping;
+    _Alignas(64) int doorbell_fd; // eventfd rung when the manager may be asleep
+    int space_fd; // eventfd rung when the terminal waits for room
+    char data[COMMAND_RING_SIZE];
+} command_ring;
+
+typedef enum journal_type {
+    JOURNAL_JOB = 1, // pid was spawned with priority, value is its start time in clock ticks
+    JOURNAL_STATUS = 2, // value is the job's new process_status
+    JOURNAL_PRIORITY = 3,
+    JOURNAL_DEPEND = 4, // pid waits for the job whose pid is value
+    JOURNAL_ARRAY = 5, // pid is the array's id, value its next task, argc arguments follow
+    JOURNAL_ARRAY_NEXT = 6, // pid is the array's id, value its next task
+    JOURNAL_LIMITS = 7, // pid's job_limits follow, value is when it first ran
+    JOURNAL_ARRAY_LIMITS = 8, // pid is the array's id, the job_limits of its tasks follow
+    JOURNAL_GROUP = 9, // pid's group name follows
+    JOURNAL_ARRAY_GROUP = 10, // pid is the array's id, its group name follows
+    JOURNAL_WEIGHT = 11, // priority is the weight of the group whose name follows
+    JOURNAL_SEQUENCE = 12, // value is pid's place in the queue, below zero if it went to the front
+    JOURNAL_ARRAY_SEQUENCE = 13 // pid is the array's id, value its place in the queue
+} journal_type;
+
+// one change to the job table as appended to the journal, 8 byte aligned.
+// A zero length marks the end, the file past what was written is all zeroes
+typedef struct journal_entry {
+    uint32_t length; // whole entry with its arguments, rounded up to 8
+    uint16_t type; // journal_type
+    uint16_t argc;
+    int32_t pid;
+    int32_t priority;
+    int64_t value;
+} journal_entry;
+
 /******************************************************************************
  * Globals
  ******************************************************************************/
 
 enum {
-    MAX_PROCESSES = 99,
-    MAX_RUNNING = 3,
-    MAX_QUEUE = MAX_PROCESSES - MAX_RUNNING
+    // records are carved out of slabs of this many, index = slab * size + offset
+    RECORD_SLAB_SIZE = 1024,
+    // terminated records kept for list before the oldest is recycled
+    HISTORY_LIMIT = 100000
+};
+
+// the process table: slabs of records, never freed, recycled through free_records
+process_record** process_records = NULL;
+size_t record_slab_count = 0;
+process_record* free_records = NULL;
+
+enum {
+    // -j, -a and limit: more slots than this is a typo, and growing to it could exhaust memory
+    MAX_RUNNING_LIMIT = 4096
+};
+
+// one slot per concurrently running job, sized by -j or the online cpu count
+int max_running = 0;
+process_record** running_processes = NULL;
+// cpu each running slot is pinned to
+int* slot_cpus = NULL;
+
+// cpus the manager was allowed to run on at startup, slots map onto them in turn
+int* available_cpus = NULL;
+int available_cpu_count = 0;
+
+bool ready_before(const process_record* a, const process_record* b);
+bool victim_before(const process_record* a, const process_record* b);
+
+// ready queue, highest priority first, by group share within a priority and FIFO within a group
+process_heap process_queue = { NULL, 0, 0, ready_before };
+// running jobs, the top is the one to preempt: lowest priority, most recently started
+process_heap running_heap = { NULL, 0, 0, victim_before };
+int64_t next_sequence = 0;
+// add_to_queue_front counts down so requeued jobs go ahead of their priority class
+int64_t front_sequence = 0;
+
+enum {
+    // a job moves its group's pass on by FAIR_STRIDE / weight
+    FAIR_STRIDE = 1 << 20,
+    MAX_GROUP_WEIGHT = 1000,
+    MAX_GROUPS = 1024
+};
+
+// stride scheduling over groups: slots go, within a priority, to the queued job with the lowest
+// start tag, so every group with work queued gets slots in proportion to its weight however many
+// jobs it queues. Group 0 is where jobs run without -g go
+job_group* groups = NULL;
+size_t group_count = 0;
+// start tag of the last job taken from the queue, where a group that had nothing queued rejoins
+int64_t fair_clock = 0;
+
+// reaped records, oldest first
+process_record* history_head = NULL;
+process_record* history_tail = NULL;
+size_t history_length = 0;
+
+// open-addressing pid -> record index, capacity is always a power of two
+process_record** pid_index = NULL;
+size_t pid_index_capacity = 0;
+size_t pid_index_count = 0;
+
+extern char** environ;
+
+// argv[0] the manager re-executes itself with to park a queued job before its exec
+const char hold_argv0[] = "processmanager-hold";
+
+enum histogram_id {
+    HISTOGRAM_QUEUE_WAIT,
+    HISTOGRAM_SPAWN,
+    HISTOGRAM_REAP_DELAY,
+    HISTOGRAM_COMMAND,
+    HISTOGRAM_COUNT
+};
+
+latency_histogram histograms[HISTOGRAM_COUNT] = {
+    { "queue_wait", "Time jobs spent READY in the queue before running, 0 for jobs started at once", 0, 0, 0, { 0 } },
+    { "spawn", "Time posix_spawn took to start a job", 0, 0, 0, { 0 } },
+    { "reap_delay", "Time from the wakeup that delivered SIGCHLD to the job being reaped", 0, 0, 0, { 0 } },
+    { "command", "Time the manager spent handling one command", 0, 0, 0, { 0 } }
+};
+enum {
+    // trace events kept, the oldest are overwritten; 24 bytes each
+    TRACE_RING_SIZE = 1 << 16
+};
+
+// the manager is single threaded, so the ring is just a head that only grows, masked into the array
+trace_event trace_ring[TRACE_RING_SIZE];
+uint64_t trace_head = 0;
+
+enum {
+    // bytes of one job's output kept in its log, the rest is discarded
+    LOG_LIMIT = 64 << 20,
+    // most a logs or tail reply carries, from the end of the log
+    LOG_REPLY_LIMIT = 1 << 20
+};
+
+// -l: directory job output is logged to, NULL leaves jobs on the manager's stdout
+const char* log_dir = NULL;
+// /dev/null, where output past LOG_LIMIT goes
+int discard_fd = -1;
+
+// when the event loop last came back from epoll_wait
+int64_t loop_wake_ns = 0;
+
+// units of /proc/<pid>/stat, read once at startup
+long clock_ticks_per_second = 100;
+long page_size_kb = 4;
+
+// round robin quantum in milliseconds, 0 lets jobs run until they exit or are stopped
+long quantum_ms = 0;
+
+enum {
+    // -m: levels of the multi-level feedback queue, level n gets the quantum << n
+    MLFQ_LEVELS = 4,
+    MLFQ_DEFAULT_QUANTUM_MS = 10,
+    // an hour, so the bottom level's slice in ns stays far from overflowing
+    MAX_QUANTUM_MS = 60 * 60 * 1000,
+    // waiting work sends every job back to the top level this often, so nothing starves
+    MLFQ_BOOST_MS = 1000
+};
+
+// -m: within a priority, jobs that used their whole slice sink a level and run after those that did not
+bool mlfq = false;
+// when the next boost is due, 0 while nothing is queued
+int64_t next_boost_ns = 0;
+int slice_timer_fd = -1;
+// expiry the slice timer is currently armed for, 0 when disarmed
+int64_t armed_slice_end = 0;
+
+enum {
+    // how long SIGKILLed jobs get to be reaped at exit before we give up on them
+    SHUTDOWN_KILL_WAIT_MS = 1000,
+    // the least clients get to read their last replies, even once the grace period is used up
+    SHUTDOWN_FLUSH_MS = 100
+};
+
+enum {
+    // how often admission control rereads PSI and the load average
+    ADMISSION_INTERVAL_MS = 500,
+    // share of the interval some task stalled on the cpu, in percent, past which no more jobs are let in
+    CPU_BUSY_PERCENT = 40,
+    // and under which there is room for one more
+    CPU_IDLE_PERCENT = 10,
+    // share some task stalled on memory past which running jobs are stopped to make room
+    MEMORY_SHED_PERCENT = 10,
+    // and under which jobs may be added again
+    MEMORY_CALM_PERCENT = 2
 };
 
-process_record* process_records[MAX_PROCESSES] = { NULL };
-process_record* running_processes[MAX_RUNNING] = { NULL };
-process_record* process_queue[MAX_QUEUE] = { NULL };
-int latest_running[MAX_RUNNING];
+// -a N: admission control lets between 1 and N jobs run depending on pressure,
+// starting from -j; without it admit_limit is always max_running
+bool adaptive_admission = false;
+int admission_limit = 0;
+int admit_limit = 0;
+int admission_timer_fd = -1;
+// /proc/pressure/cpu, /proc/pressure/memory and /proc/loadavg, -1 where the kernel has none
+int cpu_pressure_fd = -1;
+int memory_pressure_fd = -1;
+int loadavg_fd = -1;
+// cumulative stall totals at the last reading, pressure is how much they grew since
+int64_t pressure_read_ns = 0;
+uint64_t cpu_stall_us = 0;
+uint64_t memory_stall_us = 0;
+// what the last reading saw, for limit
+double cpu_pressure = 0;
+double memory_pressure = 0;
+double load_per_cpu = 0;
 
-int proc_index = 0;
-int add_index = 0;
-int rem_index = 0;
+enum {
+    // the journal file grows by this much at a time
+    JOURNAL_CHUNK = 1 << 20,
+    // past this size the journal is rewritten as just the live jobs, once it is twice what that was
+    JOURNAL_COMPACT_BYTES = 64 << 20
+};
+
+// -J FILE: every change to the job table is appended to FILE through a shared mapping, so it
+// outlives the manager being killed and the next manager started on FILE picks the jobs up
+const char* journal_path = NULL;
+const char journal_magic[8] = "PMJRNL1";
+int journal_fd = -1;
+char* journal = NULL;
+size_t journal_size = 0; // mapped, which is the file's size
+size_t journal_length = 0; // written
+size_t journal_synced = 0; // written and handed to msync
+size_t journal_compacted_length = 0;
+// jobs adopted from the journal still being watched through their pidfd
+size_t adopted_count = 0;
+
+enum {
+    // the timer wheel: buckets of TIMER_TICK_MS each, one turn is about 41 seconds
+    TIMER_WHEEL_SLOTS = 4096,
+    TIMER_TICK_MS = 10
+};
+
+// run --timeout, --cpu-limit and --deadline: every job with a limit due sits in the bucket for its
+// tick, hashed by tick so inserting and removing are O(1) however many jobs are pending, and one
+// timerfd is armed for the first bucket with anything in it
+process_record* timer_wheel[TIMER_WHEEL_SLOTS];
+size_t timer_count = 0;
+// first tick not yet looked at
+int64_t wheel_tick = 0;
+int timer_wheel_fd = -1;
+// expiry the wheel's timerfd is currently armed for, 0 when disarmed
+int64_t armed_timer_ns = 0;
+// -e: within a priority, jobs with the earliest deadline run first
+bool edf = false;
+
+// milliseconds jobs get to exit after SIGTERM, at shutdown or past a limit, before they are killed; set with -g
+long shutdown_grace_ms = 3000;
+int child_signal_fd = -1;
+
+// shared memory transport from the terminal, NULL when commands come over the pipe
+command_ring* terminal_ring = NULL;
+
+// argv of the message being dispatched, points into the message itself
+char** command_args = NULL;
+size_t command_args_capacity = 0;
+
+int manager_epoll_fd = -1;
+// every connected client, NULL where one has gone away; slot 0 is the terminal
+client** clients = NULL;
+size_t client_capacity = 0;
+client* console = NULL;
+// client whose command is being dispatched, NULL while handling anything else
+client* current_client = NULL;
+// unix socket further clients connect to, -1 without -s
+int listen_fd = -1;
+const char* socket_path = NULL;
+// -b: commands come from a script, no prompt
+bool batch_mode = false;
+enum {
+    // unread replies past which a watcher is dropped, it has to watch again for a new snapshot
+    WATCH_BACKLOG_LIMIT = 16 << 20
+};
+
+// watch: clients streamed job events, numbered and gathered over one event loop iteration
+size_t watcher_count = 0;
+uint64_t watch_sequence = 0;
+char* watch_text = NULL;
+size_t watch_text_length = 0;
+size_t watch_text_capacity = 0;
+const char* const status_names[] = { "running", "ready", "stopped", "terminated", "unused", "waiting" };
+
+// reply being built for the command being dispatched, or a notification
+reply_header current_reply;
+char* reply_text = NULL;
+size_t reply_text_length = 0;
+size_t reply_text_capacity = 0;
+
+// sources registered in the manager's epoll set, stored in the low half of epoll_event.data.u64;
+// the high half is the client slot for EVENT_CLIENT
+enum event_source {
+    EVENT_CLIENT = 0,
+    EVENT_CHILD = 1,
+    EVENT_SLICE = 2,
+    EVENT_RING = 3,
+    EVENT_LISTEN = 4,
+    EVENT_OUTPUT = 5, // high half is the record index
+    EVENT_ADMISSION = 6,
+    EVENT_ADOPTED = 7, // high half is the record index
+    EVENT_TIMER = 8
+};
+
+enum {
+    MAX_EVENTS = 8
+};
 
 /******************************************************************************
  * Declarations and initialising
  ******************************************************************************/
 
-void initialise(void)
+bool resize_running_slots(int limit);
+int find_group(const char* name, bool create);
+
+void initialise(int running_limit)
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        available_cpus = (int*)malloc((size_t)CPU_COUNT(&mask) * sizeof(int));
+        for (size_t cpu = 0; cpu < CPU_SETSIZE && available_cpus != NULL; cpu++) {
+            if (CPU_ISSET(cpu, &mask)) {
+                available_cpus[available_cpu_count++] = (int)cpu;
+            }
+        }
+    }
+    if (available_cpu_count == 0) {
+        fprintf(stderr, "unable to read the cpu affinity mask\n");
+        exit(EXIT_FAILURE);
+    }
+    int start_limit = running_limit > 0 ? running_limit : available_cpu_count;
+    start_limit = start_limit < MAX_RUNNING_LIMIT ? start_limit : MAX_RUNNING_LIMIT;
+    if (!resize_running_slots(adaptive_admission ? admission_limit : start_limit)) {
+        fprintf(stderr, "unable to allocate the running slots\n");
+        exit(EXIT_FAILURE);
+    }
+    if (adaptive_admission) {
+        admit_limit = start_limit < max_running ? start_limit : max_running;
+    }
+
+    find_group("default", true);
+
+    const long ticks = sysconf(_SC_CLK_TCK);
+    const long page_size = sysconf(_SC_PAGESIZE);
+    clock_ticks_per_second = ticks > 0 ? ticks : clock_ticks_per_second;
+    page_size_kb = page_size >= 1024 ? page_size / 1024 : page_size_kb;
+}
+void trigger_kill(process_record* p);
+void perform_exit(char* args[]);
+void start_next_process(int running_index);
+void fill_free_slots(void);
+void release_dependents(process_record* pr);
+void preempt_for_queue(void);
+void run_in_slot(process_record* p, int running_index);
+void start_slice(process_record* p, int64_t now);
+process_record* start_array_task(process_record* placeholder);
+void journal_compact(void);
+void journal_append(journal_type type, pid_t pid, int priority, int64_t value, const char* args, size_t args_length, int argc);
+bool has_limits(const process_record* p);
+void job_status_changed(process_record* p, int64_t now);
+void timer_remove(process_record* p);
+
+int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void grow_buffer(char** buffer, size_t* capacity, size_t needed)
+{
+    if (needed <= *capacity) {
+        return;
+    }
+    size_t grown = *capacity == 0 ? 4096 : *capacity;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    *buffer = (char*)realloc(*buffer, grown);
+    if (*buffer == NULL) {
+        fprintf(stderr, "unable to grow a buffer to %zu bytes\n", grown);
+        exit(EXIT_FAILURE);
+    }
+    *capacity = grown;
+}
+
+// appends formatted text to a growable buffer
+void buffer_vprintf(char** buffer, size_t* length, size_t* capacity, const char* format, va_list args)
+{
+    va_list copy;
+    va_copy(copy, args);
+    const int needed = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (needed <= 0) {
+        return;
+    }
+    grow_buffer(buffer, capacity, *length + (size_t)needed + 1);
+    vsnprintf(*buffer + *length, (size_t)needed + 1, format, args);
+    *length += (size_t)needed;
+}
+
+__attribute__((format(printf, 4, 5))) void buffer_printf(char** buffer, size_t* length, size_t* capacity, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    buffer_vprintf(buffer, length, capacity, format, args);
+    va_end(args);
+}
+
+/******************************************************************************
+ * Latency histograms
+ ******************************************************************************/
+
+size_t histogram_bucket(uint64_t value)
+{
+    if (value < (1u << HISTOGRAM_SUB_BITS)) {
+        return (size_t)value;
+    }
+    const int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return ((size_t)(shift + 1) << HISTOGRAM_SUB_BITS) + (size_t)((value >> shift) & ((1u << HISTOGRAM_SUB_BITS) - 1));
+}
+
+// largest value that lands in bucket
+uint64_t histogram_bucket_limit(size_t bucket)
+{
+    if (bucket < (1u << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+    const size_t shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    const uint64_t mantissa = (bucket & ((1u << HISTOGRAM_SUB_BITS) - 1)) | (1u << HISTOGRAM_SUB_BITS);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void histogram_record(enum histogram_id id, int64_t ns)
+{
+    latency_histogram* const h = &histograms[id];
+    const uint64_t value = ns > 0 ? (uint64_t)ns : 0;
+    h->buckets[histogram_bucket(value)]++;
+    h->count++;
+    h->sum_ns += value;
+    h->max_ns = value > h->max_ns ? value : h->max_ns;
+}
+
+// upper limit of the bucket holding the q-th quantile, never above the largest value seen
+uint64_t histogram_quantile(const latency_histogram* h, double q)
+{
+    const uint64_t rank = (uint64_t)(q * (double)h->count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            const uint64_t limit = histogram_bucket_limit(i);
+            return limit < h->max_ns ? limit : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+// Prometheus text exposition format, one histogram per latency in seconds. Every scrape has the
+// same fixed ladder of buckets, so rates over them can be taken. Powers of two are edges of our own
+// buckets too, so none of them is split between two of the exported ones
+void format_metrics_prometheus(char** out, size_t* length, size_t* capacity)
+{
+    for (size_t id = 0; id < HISTOGRAM_COUNT; id++) {
+        const latency_histogram* const h = &histograms[id];
+        buffer_printf(out, length, capacity, "# HELP processmanager_%s_seconds %s\n", h->name, h->help);
+        buffer_printf(out, length, capacity, "# TYPE processmanager_%s_seconds histogram\n", h->name);
+        uint64_t cumulative = 0;
+        size_t i = 0;
+        for (int shift = EXPORT_FIRST_SHIFT; shift <= EXPORT_LAST_SHIFT; shift++) {
+            // everything below 2^shift ns
+            for (; i < HISTOGRAM_BUCKETS && histogram_bucket_limit(i) < (1ULL << shift); i++) {
+                cumulative += h->buckets[i];
+            }
+            buffer_printf(out, length, capacity, "processmanager_%s_seconds_bucket{le=\"%.12g\"} %" PRIu64 "\n",
+                h->name, (double)(1ULL << shift) / 1e9, cumulative);
+        }
+        buffer_printf(out, length, capacity, "processmanager_%s_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", h->name, h->count);
+        buffer_printf(out, length, capacity, "processmanager_%s_seconds_sum %.9f\n", h->name, (double)h->sum_ns / 1e9);
+        buffer_printf(out, length, capacity, "processmanager_%s_seconds_count %" PRIu64 "\n", h->name, h->count);
+    }
+    buffer_printf(out, length, capacity, "# TYPE processmanager_running_jobs gauge\nprocessmanager_running_jobs %zu\n", running_heap.length);
+    buffer_printf(out, length, capacity, "# TYPE processmanager_queued_jobs gauge\nprocessmanager_queued_jobs %zu\n", process_queue.length);
+}
+
+void format_metrics_json(char** out, size_t* length, size_t* capacity)
+{
+    buffer_printf(out, length, capacity, "{\n");
+    for (size_t id = 0; id < HISTOGRAM_COUNT; id++) {
+        const latency_histogram* const h = &histograms[id];
+        buffer_printf(out, length, capacity,
+            "  \"%s\": {\"count\": %" PRIu64 ", \"sum_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64
+            ", \"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", \"p999_ns\": %" PRIu64
+            ", \"buckets\": [",
+            h->name, h->count, h->sum_ns, h->max_ns, histogram_quantile(h, 0.5), histogram_quantile(h, 0.9),
+            histogram_quantile(h, 0.99), histogram_quantile(h, 0.999));
+        const char* separator = "";
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            if (h->buckets[i] != 0) {
+                buffer_printf(out, length, capacity, "%s[%" PRIu64 ", %" PRIu64 "]", separator,
+                    histogram_bucket_limit(i), h->buckets[i]);
+                separator = ", ";
+            }
+        }
+        buffer_printf(out, length, capacity, "]},\n");
+    }
+    buffer_printf(out, length, capacity, "  \"running_jobs\": %zu,\n  \"queued_jobs\": %zu\n}\n",
+        running_heap.length, process_queue.length);
+}
+
+/******************************************************************************
+ * Scheduling trace
+ ******************************************************************************/
+
+void trace(trace_type type, pid_t pid, int slot, int arg)
+{
+    trace_event* const e = &trace_ring[trace_head++ & (TRACE_RING_SIZE - 1)];
+    e->ns = monotonic_ns();
+    e->pid = pid;
+    e->type = (int16_t)type;
+    e->slot = (int16_t)slot;
+    e->arg = arg;
+}
+
+// a signal sent to a job other than to run, preempt or stop it, recorded as the job got it
+void trace_signal(const process_record* p, int signal)
+{
+    trace(signal == SIGTERM || signal == SIGKILL ? TRACE_KILL : TRACE_SIGNAL, p->pid, p->running_index, signal);
+}
+
+// Chrome trace event JSON, which Perfetto also opens: one track per job, a span while it
+// holds a slot and a marker for everything else
+void format_trace_json(char** out, size_t* length, size_t* capacity)
+{
+    static const char* const names[] = { "spawn", "continue", "preempt", "stop", "kill", "exit", "signal" };
+    const uint64_t first = trace_head > TRACE_RING_SIZE ? trace_head - TRACE_RING_SIZE : 0;
+    const int64_t origin = first < trace_head ? trace_ring[first & (TRACE_RING_SIZE - 1)].ns : 0;
+
+    buffer_printf(out, length, capacity, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    buffer_printf(out, length, capacity,
+        "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"processmanager\"}}",
+        getpid());
+    for (uint64_t i = first; i < trace_head; i++) {
+        const trace_event* const e = &trace_ring[i & (TRACE_RING_SIZE - 1)];
+        const double ts = (double)(e->ns - origin) / 1000.0;
+        const bool ends_run = e->type == TRACE_PREEMPT || e->type == TRACE_STOP || (e->type == TRACE_REAP && e->slot != -1);
+        if (ends_run) {
+            buffer_printf(out, length, capacity, ",\n{\"name\": \"running\", \"ph\": \"E\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+                ts, getpid(), e->pid);
+        }
+        if (e->type == TRACE_CONTINUE) {
+            buffer_printf(out, length, capacity,
+                ",\n{\"name\": \"running\", \"ph\": \"B\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {\"slot\": %d, \"from\": %d}}",
+                ts, getpid(), e->pid, e->slot, e->arg);
+        } else {
+            buffer_printf(out, length, capacity,
+                ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {\"slot\": %d, \"arg\": %d}}",
+                names[e->type], ts, getpid(), e->pid, e->slot, e->arg);
+        }
+    }
+    buffer_printf(out, length, capacity, "\n]}\n");
+}
+
+// writes FILE.tmp and renames it over path so readers never see half a file, false with errno set
+bool write_file_atomically(const char* path, const char* text, size_t length)
+{
+    char temporary[strlen(path) + 5];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    const int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    const bool written = write_all(fd, text, length);
+    const int saved = errno;
+    close(fd);
+    if (!written || rename(temporary, path) == -1) {
+        const int error = written ? errno : saved;
+        unlink(temporary);
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+/******************************************************************************
+ * Replies
+ ******************************************************************************/
+
+uint64_t event_data(enum event_source source, size_t slot)
+{
+    return (uint64_t)slot << 32 | (uint64_t)source;
+}
+
+void watch_client_output(client* c, bool watch)
+{
+    if (watch == c->out_watched || manager_epoll_fd == -1) {
+        return;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.u64 = event_data(EVENT_CLIENT, c->slot);
+    if (c->out_fd == c->in_fd) {
+        ev.events = watch ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        epoll_ctl(manager_epoll_fd, EPOLL_CTL_MOD, c->out_fd, &ev);
+    } else {
+        ev.events = EPOLLOUT;
+        epoll_ctl(manager_epoll_fd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, c->out_fd, &ev);
+    }
+    c->out_watched = watch;
+}
+
+// writes as much of the client's pending replies as it will take, the rest waits for EPOLLOUT
+void flush_replies(client* c)
+{
+    size_t written = 0;
+    while (written < c->out_length) {
+        const ssize_t n = write(c->out_fd, c->out + written, c->out_length - written);
+        if (n > 0) {
+            written += (size_t)n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && errno == EAGAIN) {
+            break;
+        } else {
+            // the client is gone, nobody is left to read these
+            written = c->out_length;
+        }
+    }
+    c->out_length -= written;
+    // out is still NULL before the first reply
+    if (written > 0 && c->out_length > 0) {
+        memmove(c->out, c->out + written, c->out_length);
+    }
+    watch_client_output(c, c->out_length > 0);
+}
+
+// sends header and text to c, or keeps them for EPOLLOUT
+void queue_reply(client* c, reply_header* header, const char* text, size_t length)
+{
+    header->length = (uint32_t)(sizeof(*header) + length + 1);
+    grow_buffer(&c->out, &c->out_capacity, c->out_length + header->length);
+    memcpy(c->out + c->out_length, header, sizeof(*header));
+    memcpy(c->out + c->out_length + sizeof(*header), text, length);
+    c->out[c->out_length + header->length - 1] = '\0';
+    c->out_length += header->length;
+    flush_replies(c);
+}
+
+void begin_reply(uint32_t request_id)
+{
+    memset(&current_reply, 0, sizeof(current_reply));
+    current_reply.request_id = request_id;
+    current_reply.status = REPLY_OK;
+    reply_text_length = 0;
+}
+
+// queues the reply being built for whoever sent the command, notifications go to the terminal
+// and are dropped when they have no text
+void end_reply(void)
+{
+    client* const c = current_client != NULL ? current_client : console;
+    if (c == NULL || (current_reply.request_id == 0 && reply_text_length == 0)) {
+        begin_reply(0);
+        return;
+    }
+    queue_reply(c, &current_reply, reply_text, reply_text_length);
+    begin_reply(0);
+}
+
+void respond_v(const char* format, va_list args)
+{
+    buffer_vprintf(&reply_text, &reply_text_length, &reply_text_capacity, format, args);
+}
+
+// appends text to the reply being built
+__attribute__((format(printf, 1, 2))) void respond(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    respond_v(format, args);
+    va_end(args);
+}
+
+// appends text and marks the command as failed
+__attribute__((format(printf, 1, 2))) void respond_error(const char* format, ...)
+{
+    current_reply.status = REPLY_FAILED;
+    va_list args;
+    va_start(args, format);
+    respond_v(format, args);
+    va_end(args);
+}
+
+/******************************************************************************
+ * Watch
+ ******************************************************************************/
+
+// one line of JSON about a job: what happened to it, where it is now and, once it has exited, how it went
+void format_job_event(char** out, size_t* length, size_t* capacity, uint64_t seq, const char* event, const process_record* p)
+{
+    buffer_printf(out, length, capacity, "{\"seq\":%" PRIu64 ",\"ns\":%" PRId64 ",\"event\":\"%s\",\"pid\":%d,\"index\":%d",
+        seq, monotonic_ns(), event, p->pid, p->index);
+    // a job just spawned has no status until it is queued or started
+    if (p->status != UNUSED) {
+        buffer_printf(out, length, capacity, ",\"status\":\"%s\"", status_names[p->status]);
+    }
+    // the slot it runs in, or has just left
+    buffer_printf(out, length, capacity, ",\"priority\":%d,\"slot\":%d", p->priority, p->running_index);
+    const process_usage* const u = &p->usage;
+    if (u->end_ns != 0 && p->status == TERMINATED) {
+        if (p->adopted) {
+            buffer_printf(out, length, capacity, ",\"code\":null");
+        } else if (WIFSIGNALED(u->exit_status)) {
+            buffer_printf(out, length, capacity, ",\"signal\":%d", WTERMSIG(u->exit_status));
+        } else {
+            buffer_printf(out, length, capacity, ",\"code\":%d", WEXITSTATUS(u->exit_status));
+        }
+        buffer_printf(out, length, capacity,
+            ",\"wall_ns\":%" PRId64 ",\"user_us\":%" PRId64 ",\"system_us\":%" PRId64 ",\"max_rss_kb\":%ld,\"descendants\":%d",
+            u->end_ns - u->start_ns, u->user_us, u->system_us, u->max_rss_kb, u->descendants);
+    }
+    buffer_printf(out, length, capacity, "}\n");
+}
+
+// a job event for the watchers, costs nothing while there are none
+void watch_event(const char* event, const process_record* p)
+{
+    if (watcher_count > 0) {
+        format_job_event(&watch_text, &watch_text_length, &watch_text_capacity, ++watch_sequence, event, p);
+    }
+}
+
+// sends the events gathered since the last call to every watcher as one notification
+void flush_watch(void)
+{
+    if (watch_text_length == 0) {
+        return;
+    }
+    for (size_t i = 0; i < client_capacity; i++) {
+        client* const c = clients[i];
+        if (c == NULL || !c->watching) {
+            continue;
+        }
+        reply_header header;
+        memset(&header, 0, sizeof(header));
+        header.status = REPLY_OK;
+        if (c->out_length > WATCH_BACKLOG_LIMIT) {
+            // it stopped reading, events would only pile up; it can watch again from a fresh snapshot
+            const char overflow[] = "{\"event\":\"overflow\"}\n";
+            c->watching = false;
+            watcher_count--;
+            queue_reply(c, &header, overflow, sizeof(overflow) - 1);
+            continue;
+        }
+        queue_reply(c, &header, watch_text, watch_text_length);
+    }
+    watch_text_length = 0;
+}
+
+/******************************************************************************
+ * Pid index
+ ******************************************************************************/
+
+size_t pid_slot(pid_t pid, size_t capacity)
+{
+    // fibonacci hashing, pids are mostly sequential so spread them out. The top bits of the
+    // product are the well mixed ones, so take as many of those as the power of two capacity needs
+    const int shift = 64 - __builtin_ctzll(capacity);
+    return (size_t)(((uint64_t)(uint32_t)pid * 11400714819323198485ull) >> shift);
+}
+
+void pid_index_grow(void)
+{
+    const size_t old_capacity = pid_index_capacity;
+    process_record** old = pid_index;
+
+    pid_index_capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    pid_index = (process_record**)calloc(pid_index_capacity, sizeof(process_record*));
+    if (pid_index == NULL) {
+        fprintf(stderr, "unable to grow the pid index\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i] == NULL) {
+            continue;
+        }
+        size_t slot = pid_slot(old[i]->pid, pid_index_capacity);
+        while (pid_index[slot] != NULL) {
+            slot = (slot + 1) & (pid_index_capacity - 1);
+        }
+        pid_index[slot] = old[i];
+    }
+    free(old);
+}
+
+void pid_index_insert(process_record* pr)
+{
+    // keep the load factor under 1/2 so probe sequences stay short
+    if ((pid_index_count + 1) * 2 > pid_index_capacity) {
+        pid_index_grow();
+    }
+    size_t slot = pid_slot(pr->pid, pid_index_capacity);
+    while (pid_index[slot] != NULL && pid_index[slot]->pid != pr->pid) {
+        slot = (slot + 1) & (pid_index_capacity - 1);
+    }
+    if (pid_index[slot] == NULL) {
+        pid_index_count++;
+    }
+    pid_index[slot] = pr;
+}
+
+process_record* pid_index_find(pid_t pid)
+{
+    if (pid_index_count == 0) {
+        return NULL;
+    }
+    size_t slot = pid_slot(pid, pid_index_capacity);
+    while (pid_index[slot] != NULL) {
+        if (pid_index[slot]->pid == pid) {
+            return pid_index[slot];
+        }
+        slot = (slot + 1) & (pid_index_capacity - 1);
+    }
+    return NULL;
+}
+
+void pid_index_remove(process_record* pr)
+{
+    if (pid_index_count == 0) {
+        return;
+    }
+    const size_t mask = pid_index_capacity - 1;
+    size_t slot = pid_slot(pr->pid, pid_index_capacity);
+    while (pid_index[slot] != NULL && pid_index[slot]->pid != pr->pid) {
+        slot = (slot + 1) & mask;
+    }
+    // the pid may already have been reused by a newer job, leave that entry alone
+    if (pid_index[slot] != pr) {
+        return;
+    }
+    pid_index[slot] = NULL;
+    pid_index_count--;
+
+    // backward-shift the rest of the cluster so lookups never need tombstones
+    size_t hole = slot;
+    size_t next = (slot + 1) & mask;
+    while (pid_index[next] != NULL) {
+        const size_t home = pid_slot(pid_index[next]->pid, pid_index_capacity);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            pid_index[hole] = pid_index[next];
+            pid_index[next] = NULL;
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
+
+/******************************************************************************
+ * Process table
+ ******************************************************************************/
+
+void add_record_slab(void)
+{
+    process_record* slab = (process_record*)malloc(RECORD_SLAB_SIZE * sizeof(process_record));
+    process_record** slabs = (process_record**)realloc(
+        process_records, (record_slab_count + 1) * sizeof(process_record*));
+    if (slab == NULL || slabs == NULL) {
+        fprintf(stderr, "unable to grow the process table\n");
+        exit(EXIT_FAILURE);
+    }
+    process_records = slabs;
+    process_records[record_slab_count] = slab;
+
+    // push in reverse so the lowest indices are handed out first
+    for (int i = RECORD_SLAB_SIZE - 1; i >= 0; i--) {
+        process_record* const pr = &slab[i];
+        pr->pid = 0;
+        pr->index = (int)record_slab_count * RECORD_SLAB_SIZE + i;
+        pr->running_index = -1;
+        pr->status = UNUSED;
+        pr->array = NULL;
+        pr->dependents = NULL;
+        pr->dependent_count = 0;
+        pr->dependent_capacity = 0;
+        pr->output_fd = -1;
+        pr->log_fd = -1;
+        pr->pidfd = -1;
+        pr->timer_ns = 0;
+        pr->prev = NULL;
+        pr->next = free_records;
+        free_records = pr;
+    }
+    record_slab_count++;
+}
+
+process_record* alloc_record(void)
+{
+    if (free_records == NULL) {
+        add_record_slab();
+    }
+    process_record* const pr = free_records;
+    free_records = pr->next;
+    pr->next = NULL;
+    return pr;
+}
+
+void close_output(process_record* pr);
+
+void free_record(process_record* pr)
+{
+    close_output(pr);
+    // closing the pidfd also takes it out of the epoll set
+    if (pr->pidfd != -1) {
+        close(pr->pidfd);
+        pr->pidfd = -1;
+        adopted_count--;
+    }
+    pid_index_remove(pr);
+    timer_remove(pr);
+    pr->status = UNUSED;
+    pr->running_index = -1;
+    pr->array = NULL;
+    free(pr->dependents);
+    pr->dependents = NULL;
+    pr->dependent_count = 0;
+    pr->dependent_capacity = 0;
+    pr->prev = NULL;
+    pr->next = free_records;
+    free_records = pr;
+}
+
+// keeps a reaped record around for list, recycling the oldest past HISTORY_LIMIT
+void add_to_history(process_record* pr)
+{
+    pr->prev = history_tail;
+    pr->next = NULL;
+    if (history_tail != NULL) {
+        history_tail->next = pr;
+    } else {
+        history_head = pr;
+    }
+    history_tail = pr;
+    history_length++;
+
+    if (history_length > HISTORY_LIMIT) {
+        process_record* const oldest = history_head;
+        history_head = oldest->next;
+        history_head->prev = NULL;
+        history_length--;
+        free_record(oldest);
+    }
+}
+
+/******************************************************************************
+ * Job groups
+ ******************************************************************************/
+
+// index of the group called name, created with weight 1 if create is set; -1 if there is none
+// or there are already MAX_GROUPS
+int find_group(const char* name, bool create)
+{
+    for (size_t i = 0; i < group_count; i++) {
+        if (strcmp(groups[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    if (!create || group_count == MAX_GROUPS) {
+        return -1;
+    }
+    job_group* const grown = (job_group*)realloc(groups, (group_count + 1) * sizeof(job_group));
+    char* const copy = strdup(name);
+    if (grown == NULL || copy == NULL) {
+        fprintf(stderr, "unable to add a job group\n");
+        exit(EXIT_FAILURE);
+    }
+    groups = grown;
+    memset(&groups[group_count], 0, sizeof(job_group));
+    groups[group_count].name = copy;
+    groups[group_count].weight = 1;
+    // it starts level with everyone else rather than owed the time since the manager started
+    groups[group_count].pass = fair_clock;
+    return (int)group_count++;
+}
+
+// a job joining the queue starts at its group's pass, or at the current virtual time if the group
+// has fallen behind it by having nothing queued, and moves the pass on by the group's stride
+void charge_group(process_record* pr)
+{
+    job_group* const g = &groups[pr->group];
+    pr->fair_tag = g->pass > fair_clock ? g->pass : fair_clock;
+    pr->fair_charge = FAIR_STRIDE / g->weight;
+    pr->fair_run_ns = 0;
+    g->pass = pr->fair_tag + pr->fair_charge;
+}
+
+int64_t slice_ns(const process_record* p);
+
+// a job that ends part way through its turn, killed or not, gives its group back the stride for
+// the part of the slice it did not run. Without round robin a turn is the whole job, so only a job
+// that never got a slot is owed anything, and it is owed all of it
+void settle_group(process_record* pr)
+{
+    const int64_t turn_ns = quantum_ms > 0 ? slice_ns(pr) : 0;
+    int64_t unused = 0;
+    if (pr->fair_run_ns == 0) {
+        unused = pr->fair_charge;
+    } else if (pr->fair_run_ns < turn_ns) {
+        unused = (int64_t)((double)pr->fair_charge * (double)(turn_ns - pr->fair_run_ns) / (double)turn_ns);
+    }
+    groups[pr->group].pass -= unused;
+    pr->fair_charge = 0;
+}
+
+void journal_group(journal_type type, int32_t id, const process_record* p)
+{
+    if (p->group != 0) {
+        const char* const name = groups[p->group].name;
+        journal_append(type, id, 0, 0, name, strlen(name) + 1, 1);
+    }
+}
+
+/******************************************************************************
+ * Queue and priority management
+ ******************************************************************************/
+
+// -e orders by this, a job without a deadline goes after every job with one
+int64_t deadline_key(const process_record* p)
+{
+    return p->limits.deadline_ns != 0 ? p->limits.deadline_ns : INT64_MAX;
+}
+
+bool ready_before(const process_record* a, const process_record* b)
+{
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    if (edf && deadline_key(a) != deadline_key(b)) {
+        return deadline_key(a) < deadline_key(b);
+    }
+    if (mlfq && a->level != b->level) {
+        return a->level < b->level;
+    }
+    if (a->fair_tag != b->fair_tag) {
+        return a->fair_tag < b->fair_tag;
+    }
+    return a->sequence < b->sequence;
+}
+
+bool victim_before(const process_record* a, const process_record* b)
+{
+    if (a->priority != b->priority) {
+        return a->priority < b->priority;
+    }
+    if (edf && deadline_key(a) != deadline_key(b)) {
+        return deadline_key(a) > deadline_key(b);
+    }
+    if (mlfq && a->level != b->level) {
+        return a->level > b->level;
+    }
+    return a->sequence > b->sequence;
+}
+
+// whether a should run rather than b regardless of arrival order: a higher priority,
+// with -e an earlier deadline, or with -m a higher level
+bool outranks(const process_record* a, const process_record* b)
+{
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    if (edf && deadline_key(a) != deadline_key(b)) {
+        return deadline_key(a) < deadline_key(b);
+    }
+    return mlfq && a->level < b->level;
+}
+
+void heap_place(process_heap* h, size_t i, process_record* pr)
+{
+    h->items[i] = pr;
+    pr->heap_index = i;
+}
+
+void heap_sift_up(process_heap* h, size_t i)
+{
+    process_record* const pr = h->items[i];
+    while (i > 0) {
+        const size_t parent = (i - 1) / 2;
+        if (!h->before(pr, h->items[parent])) {
+            break;
+        }
+        heap_place(h, i, h->items[parent]);
+        i = parent;
+    }
+    heap_place(h, i, pr);
+}
+
+void heap_sift_down(process_heap* h, size_t i)
+{
+    process_record* const pr = h->items[i];
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= h->length) {
+            break;
+        }
+        if (child + 1 < h->length && h->before(h->items[child + 1], h->items[child])) {
+            child++;
+        }
+        if (!h->before(h->items[child], pr)) {
+            break;
+        }
+        heap_place(h, i, h->items[child]);
+        i = child;
+    }
+    heap_place(h, i, pr);
+}
+
+void heap_push(process_heap* h, process_record* pr)
+{
+    if (h->length == h->capacity) {
+        h->capacity = h->capacity == 0 ? 64 : h->capacity * 2;
+        h->items = (process_record**)realloc(h->items, h->capacity * sizeof(process_record*));
+        if (h->items == NULL) {
+            fprintf(stderr, "unable to grow the process heap\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    heap_place(h, h->length++, pr);
+    heap_sift_up(h, pr->heap_index);
+}
+
+void heap_remove(process_heap* h, process_record* pr)
+{
+    const size_t i = pr->heap_index;
+    process_record* const last = h->items[--h->length];
+    if (i == h->length) {
+        return;
+    }
+    heap_place(h, i, last);
+    heap_sift_up(h, i);
+    heap_sift_down(h, last->heap_index);
+}
+
+// restores the heap after the keys of many records changed
+void heap_rebuild(process_heap* h)
+{
+    for (size_t i = h->length / 2; i > 0; i--) {
+        heap_sift_down(h, i - 1);
+    }
+}
+
+// restores the heap after pr's key changed
+void heap_update(process_heap* h, process_record* pr)
+{
+    heap_sift_up(h, pr->heap_index);
+    heap_sift_down(h, pr->heap_index);
+}
+
+process_record* heap_top(const process_heap* h)
+{
+    return h->length > 0 ? h->items[0] : NULL;
+}
+
+// slot of the running job to preempt first, -1 when nothing runs
+int lowest_priority_index(void)
+{
+    process_record* const victim = heap_top(&running_heap);
+    return victim != NULL ? victim->running_index : -1;
+}
+
+// every change of status goes through here so it is timestamped
+void set_status(process_record* pr, process_status status)
+{
+    const int64_t now = monotonic_ns();
+    if (status == RUNNING && (pr->status == READY || pr->status == UNUSED)) {
+        histogram_record(HISTOGRAM_QUEUE_WAIT, pr->status == READY ? now - pr->status_since : 0);
+    }
+    const process_status old = pr->status;
+    if (old == READY && status == RUNNING && pr->fair_tag > fair_clock) {
+        fair_clock = pr->fair_tag;
+    }
+    if (old == RUNNING) {
+        groups[pr->group].slot_ns += now - pr->status_since;
+        pr->fair_run_ns += now - pr->status_since;
+    }
+    pr->status = status;
+    pr->status_since = now;
+    // array placeholders have no pid and are journaled and watched through their tasks
+    if (pr->pid <= 0) {
+        return;
+    }
+    journal_append(JOURNAL_STATUS, pr->pid, 0, status, NULL, 0, 0);
+    if (watcher_count > 0) {
+        const char* const events[] = { old == STOPPED ? "resumed" : "started", old == RUNNING ? "preempted" : "queued",
+            "stopped", pr->usage.end_ns != 0 ? "exited" : "killed", "unused", "waiting" };
+        watch_event(events[status], pr);
+    }
+    if (has_limits(pr)) {
+        job_status_changed(pr, now);
+    }
+}
+
+// queues a new job or one whose slice ran out, charging its group for the slot it is after
+// so a restart puts the job back where it was, front of the queue included
+void journal_sequence(const process_record* pr)
+{
+    if (pr->array != NULL) {
+        journal_append(JOURNAL_ARRAY_SEQUENCE, pr->index, 0, pr->sequence, NULL, 0, 0);
+    } else if (pr->pid > 0) {
+        journal_append(JOURNAL_SEQUENCE, pr->pid, 0, pr->sequence, NULL, 0, 0);
+    }
+}
+
+void add_to_queue(process_record* pr)
+{
+    pr->sequence = ++next_sequence;
+    journal_sequence(pr);
+    charge_group(pr);
+    heap_push(&process_queue, pr);
+}
+
+// a job preempted before its slice ran out keeps the start tag it was charged
+void add_to_queue_front(process_record* pr)
+{
+    pr->sequence = --front_sequence;
+    journal_sequence(pr);
+    heap_push(&process_queue, pr);
+}
+
+void unlink_from_queue(process_record* pr)
+{
+    heap_remove(&process_queue, pr);
+}
+
+process_record* remove_from_queue(void)
+{
+    process_record* const pr = heap_top(&process_queue);
+    if (pr != NULL) {
+        heap_remove(&process_queue, pr);
+    }
+    return pr;
+}
+
+/******************************************************************************
+ * Resource accounting
+ ******************************************************************************/
+
+int64_t timeval_us(struct timeval tv)
+{
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// adds one reaped process, the job itself or a descendant, to what its job used
+void add_usage(process_usage* u, const struct rusage* usage)
+{
+    u->user_us += timeval_us(usage->ru_utime);
+    u->system_us += timeval_us(usage->ru_stime);
+    if (usage->ru_maxrss > u->max_rss_kb) {
+        u->max_rss_kb = usage->ru_maxrss;
+    }
+    u->voluntary_switches += usage->ru_nvcsw;
+    u->involuntary_switches += usage->ru_nivcsw;
+    u->blocks_in += usage->ru_inblock;
+    u->blocks_out += usage->ru_oublock;
+}
+
+// one read of /proc/<pid>/stat, false if the job is already gone
+bool sample_process(pid_t pid, process_sample* sample)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    char buffer[1024];
+    const ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    buffer[n] = '\0';
+
+    // the command name may itself hold spaces and parentheses, the fields start after the last ')'
+    const char* const fields = strrchr(buffer, ')');
+    unsigned long minor_faults;
+    unsigned long major_faults;
+    unsigned long user_ticks;
+    unsigned long system_ticks;
+    long threads;
+    long rss_pages;
+    if (fields == NULL
+        || sscanf(fields + 2,
+               "%c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu %*d %*d %*d %*d %ld %*d %" SCNu64 " %*u %ld",
+               &sample->state, &minor_faults, &major_faults, &user_ticks, &system_ticks, &threads,
+               &sample->start_ticks, &rss_pages)
+            != 8) {
+        return false;
+    }
+    sample->user_us = (int64_t)user_ticks * 1000000 / clock_ticks_per_second;
+    sample->system_us = (int64_t)system_ticks * 1000000 / clock_ticks_per_second;
+    sample->rss_kb = rss_pages * page_size_kb;
+    sample->threads = threads;
+    sample->minor_faults = (long)minor_faults;
+    sample->major_faults = (long)major_faults;
+    return true;
+}
+
+/******************************************************************************
+ * Auto-start next process
+ ******************************************************************************/
+
+// every job leads its own process group, so a job's pid is also the id of its group
+int signal_job(const process_record* p, int signal)
+{
+    if (p->pid <= 0) {
+        return -1;
+    }
+    // a job that moved itself out of its group can still be reached directly
+    if (kill(-p->pid, signal) == -1 && errno == ESRCH) {
+        return kill(p->pid, signal);
+    }
+    return 0;
+}
+
+// whether anything, zombies included, is left in the group a job started
+bool group_alive(pid_t pgid)
+{
+    return kill(-pgid, 0) == 0 || errno != ESRCH;
+}
+
+// reaps one exited child, returning its pid or 0 once there is nothing to reap.
+// As subreaper we also inherit helpers whose parent exited; those are charged to the
+// job whose group they are in. finished is the job once its whole group is gone.
+pid_t reap_child(process_record** finished)
+{
+    *finished = NULL;
+    // peek first, a zombie still knows its process group
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid == 0) {
+        return 0;
+    }
+    const pid_t pid = info.si_pid;
+    process_record* job = pid_index_find(pid);
+    // a helper can be handed the pid of a job long since reaped
+    if (job != NULL && job->usage.exited) {
+        job = NULL;
+    }
+    process_record* owner = job;
+    if (owner == NULL) {
+        owner = pid_index_find(getpgid(pid));
+        if (owner != NULL && owner->usage.end_ns != 0) {
+            owner = NULL;
+        }
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        return 0;
+    }
+    if (owner == NULL) {
+        return pid;
+    }
+    add_usage(&owner->usage, &usage);
+    if (job != NULL) {
+        trace(TRACE_REAP, pid, job->running_index, status);
+        job->usage.exited = true;
+        job->usage.exit_status = status;
+    } else {
+        owner->usage.descendants++;
+    }
+    // the job keeps its slot until the helpers it left behind are gone too
+    if (owner->usage.exited && !group_alive(owner->pid)) {
+        owner->usage.end_ns = monotonic_ns();
+        *finished = owner;
+    }
+    return pid;
+}
+
+// a job and everything in its group is gone: hand its slot on and let its dependents go
+void finish_job(process_record* pr)
+{
+    // a slice can run out between the job exiting and us reaping it, leaving it queued
+    if (pr->status == READY) {
+        unlink_from_queue(pr);
+    }
+    // a killed job already left the running heap when it was killed
+    const bool in_running_heap = pr->status == RUNNING;
+    // gone before its SIGKILL was due
+    pr->kill_at_ns = 0;
+    set_status(pr, TERMINATED);
+    release_dependents(pr);
+    settle_group(pr);
+    job_group* const g = &groups[pr->group];
+    g->finished++;
+    g->user_us += pr->usage.user_us;
+    g->system_us += pr->usage.system_us;
+
+    const int running_index = pr->running_index;
+    pr->running_index = -1;
+    add_to_history(pr);
+    if (running_index == -1) {
+        return;
+    }
+    running_processes[running_index] = NULL;
+    if (in_running_heap) {
+        heap_remove(&running_heap, pr);
+    }
+
+    // Start next process in the queue
+    fill_free_slots();
+}
+
+void process_tracker(void)
+{
+    // reap whatever exited, the pid index finds its record without walking the slots
+    process_record* pr;
+    while (reap_child(&pr) > 0) {
+        if (pr == NULL) {
+            continue;
+        }
+        histogram_record(HISTOGRAM_REAP_DELAY, monotonic_ns() - loop_wake_ns);
+        respond("parent> Child %d exited with code %d.\n", pr->pid, pr->usage.exit_status);
+        finish_job(pr);
+    }
+    // dependents released by jobs that held no slot
+    fill_free_slots();
+    preempt_for_queue();
+}
+
+// an adopted job's pidfd turned readable. It is not our child, so neither its exit status
+// nor its usage can be had, and its helpers went to whoever reaps for its old manager
+void adopted_exited(process_record* pr)
+{
+    close(pr->pidfd);
+    pr->pidfd = -1;
+    adopted_count--;
+    pr->usage.exited = true;
+    pr->usage.end_ns = monotonic_ns();
+}
+
+/******************************************************************************
+ * Helper Functions
+ ******************************************************************************/
+
+void start_next_process(int running_index)
+{
+    process_record* next = remove_from_queue();
+    if (next != NULL && next->array != NULL) {
+        next = start_array_task(next);
+    }
+    if (next != NULL) {
+        run_in_slot(next, running_index);
+    }
+}
+
+// a slot a job may start in, -1 when they are all taken or admission control is holding jobs back
+int find_free_slot(void)
+{
+    if ((int)running_heap.length >= admit_limit) {
+        return -1;
+    }
+    for (int i = 0; i < max_running; i++) {
+        if (running_processes[i] == NULL) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// starts queued jobs while there are free slots admission control lets them into
+void fill_free_slots(void)
+{
+    for (int i = find_free_slot(); i != -1 && heap_top(&process_queue) != NULL; i = find_free_slot()) {
+        start_next_process(i);
+    }
+}
+
+void pin_to_slot(pid_t pid, int running_index)
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET((size_t)slot_cpus[running_index], &mask);
+    // the job may already be gone, the reaper will catch up with it
+    sched_setaffinity(pid, sizeof(mask), &mask);
+}
+
+// continues a job in a free slot, pinned to that slot's cpu
+void run_in_slot(process_record* p, int running_index)
+{
+    pin_to_slot(p->pid, running_index);
+    signal_job(p, SIGCONT);
+    trace(TRACE_CONTINUE, p->pid, running_index, (int)p->status);
+    p->running_index = running_index;
+    set_status(p, RUNNING);
+    p->sequence = ++next_sequence;
+    journal_sequence(p);
+    start_slice(p, monotonic_ns());
+    running_processes[running_index] = p;
+    heap_push(&running_heap, p);
+}
+
+// stops the job in a slot and requeues it, at the front of its priority unless its slice ran out.
+// False if the slot holds a killed job, which keeps it until it is reaped
+bool preempt_slot(int running_index, bool to_front)
+{
+    process_record* const to_stop = running_processes[running_index];
+    if (to_stop->status != RUNNING) {
+        return false;
+    }
+    if (signal_job(to_stop, SIGSTOP) != 0) {
+        respond("unable to stop\n");
+    }
+    trace(TRACE_PREEMPT, to_stop->pid, running_index, to_front);
+    set_status(to_stop, READY);
+    to_stop->running_index = -1;
+    heap_remove(&running_heap, to_stop);
+    running_processes[running_index] = NULL;
+    if (to_front) {
+        add_to_queue_front(to_stop);
+    } else {
+        add_to_queue(to_stop);
+    }
+    return true;
+}
+
+// cpu time the job's own process has had, from /proc/<pid>/schedstat, -1 once it is gone
+int64_t job_cpu_ns(pid_t pid)
+{
+    char path[40];
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", pid);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    char buffer[96];
+    const ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    buffer[n] = '\0';
+    return strtoll(buffer, NULL, 10);
+}
+
+int64_t slice_ns(const process_record* p)
+{
+    return (int64_t)quantum_ms * 1000000 << (mlfq ? p->level : 0);
+}
+
+void start_slice(process_record* p, int64_t now)
+{
+    p->slice_end = quantum_ms > 0 ? now + slice_ns(p) : 0;
+    if (mlfq) {
+        p->slice_cpu_ns = job_cpu_ns(p->pid);
+    }
+}
+
+// -m: a job that spent at least half its slice on the cpu drops a level. One that mostly blocked
+// keeps its level and returns false, it should not sit on a slot while others wait
+bool charge_slice(process_record* p)
+{
+    const int64_t cpu_ns = job_cpu_ns(p->pid);
+    if (cpu_ns < 0 || p->slice_cpu_ns < 0) {
+        return true;
+    }
+    if ((cpu_ns - p->slice_cpu_ns) * 2 < slice_ns(p)) {
+        return false;
+    }
+    if (p->level < MLFQ_LEVELS - 1) {
+        p->level++;
+        heap_update(&running_heap, p);
+    }
+    return true;
+}
+
+// -m: every job goes back to the top level
+void boost_levels(void)
+{
+    for (size_t i = 0; i < process_queue.length; i++) {
+        process_queue.items[i]->level = 0;
+    }
+    for (size_t i = 0; i < running_heap.length; i++) {
+        running_heap.items[i]->level = 0;
+    }
+    heap_rebuild(&process_queue);
+    heap_rebuild(&running_heap);
+}
+
+// round robin: jobs whose quantum ran out make way for queued work they do not outrank
+void rotate_expired_slices(void)
+{
+    const int64_t now = monotonic_ns();
+    if (mlfq && next_boost_ns != 0 && next_boost_ns <= now) {
+        boost_levels();
+        next_boost_ns = 0;
+    }
+    for (int i = 0; i < max_running; i++) {
+        process_record* const p = running_processes[i];
+        if (p == NULL || p->status != RUNNING || p->slice_end == 0 || p->slice_end > now) {
+            continue;
+        }
+        const bool blocked = mlfq && !charge_slice(p);
+        process_record* const next = heap_top(&process_queue);
+        if (next == NULL || next->priority < p->priority || (!blocked && outranks(p, next))) {
+            start_slice(p, now);
+            continue;
+        }
+        if (preempt_slot(i, false)) {
+            start_next_process(i);
+        }
+    }
+}
+
+// points the slice timer at the earliest quantum expiry among the running jobs
+void arm_slice_timer(void)
+{
+    int64_t earliest = 0;
+    for (int i = 0; i < max_running; i++) {
+        process_record* const p = running_processes[i];
+        // a killed job's slice is never renewed, it just waits in its slot to be reaped
+        if (p != NULL && p->status == RUNNING && p->slice_end != 0 && (earliest == 0 || p->slice_end < earliest)) {
+            earliest = p->slice_end;
+        }
+    }
+    // boosts only matter while something waits, an idle manager still sleeps
+    if (mlfq && process_queue.length > 0) {
+        if (next_boost_ns == 0) {
+            next_boost_ns = monotonic_ns() + MLFQ_BOOST_MS * 1000000L;
+        }
+        if (earliest == 0 || next_boost_ns < earliest) {
+            earliest = next_boost_ns;
+        }
+    }
+    if (earliest == armed_slice_end) {
+        return;
+    }
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = earliest / 1000000000;
+    spec.it_value.tv_nsec = earliest % 1000000000;
+    timerfd_settime(slice_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    armed_slice_end = earliest;
+}
+
+// preempts the lowest priority running jobs while queued work outranks them
+void preempt_for_queue(void)
+{
+    while (true) {
+        process_record* const next = heap_top(&process_queue);
+        process_record* const victim = heap_top(&running_heap);
+        if (next == NULL || victim == NULL || (int)running_heap.length < admit_limit
+            || !outranks(next, victim)) {
+            return;
+        }
+        const int running_index = victim->running_index;
+        if (next->array != NULL) {
+            respond("preempting %d for array [%d]\n", victim->pid, next->index);
+        } else {
+            respond("preempting %d for %d\n", victim->pid, next->pid);
+        }
+        if (!preempt_slot(running_index, true)) {
+            return;
+        }
+        start_next_process(running_index);
+    }
+}
+
+// false if the slots could not be grown, leaving them as they were
+bool resize_running_slots(int limit)
+{
+    const int old_limit = max_running;
+
+    // grow before touching any job, so running out of memory changes nothing
+    if (limit > old_limit) {
+        process_record** const slots
+            = (process_record**)realloc(running_processes, (size_t)limit * sizeof(process_record*));
+        if (slots == NULL) {
+            return false;
+        }
+        running_processes = slots;
+        int* const cpus = (int*)realloc(slot_cpus, (size_t)limit * sizeof(int));
+        if (cpus == NULL) {
+            return false;
+        }
+        slot_cpus = cpus;
+    }
+
+    // shrinking: requeue the lowest priority jobs until the rest fit
+    int running = 0;
+    for (int i = 0; i < old_limit; i++) {
+        if (running_processes[i] != NULL) {
+            running++;
+        }
+    }
+    for (; running > limit && running_heap.length > 0; running--) {
+        preempt_slot(lowest_priority_index(), true);
+    }
+    // then move survivors out of the slots that are going away
+    for (int i = limit; i < old_limit; i++) {
+        process_record* const p = running_processes[i];
+        if (p == NULL) {
+            continue;
+        }
+        int j = 0;
+        while (j < limit && running_processes[j] != NULL) {
+            j++;
+        }
+        // only killed jobs are left over, they are reaped without a slot
+        if (j == limit) {
+            p->running_index = -1;
+            running_processes[i] = NULL;
+            continue;
+        }
+        running_processes[j] = p;
+        running_processes[i] = NULL;
+        p->running_index = j;
+        pin_to_slot(p->pid, j);
+    }
+
+    // shrinking in place cannot fail, the old arrays are just bigger than they need to be
+    if (limit < old_limit) {
+        process_record** const slots
+            = (process_record**)realloc(running_processes, (size_t)limit * sizeof(process_record*));
+        running_processes = slots != NULL ? slots : running_processes;
+        int* const cpus = (int*)realloc(slot_cpus, (size_t)limit * sizeof(int));
+        slot_cpus = cpus != NULL ? cpus : slot_cpus;
+    }
+    for (int i = old_limit; i < limit; i++) {
+        running_processes[i] = NULL;
+    }
+    for (int i = 0; i < limit; i++) {
+        slot_cpus[i] = available_cpus[i % available_cpu_count];
+    }
+    max_running = limit;
+    if (!adaptive_admission || admit_limit > limit) {
+        admit_limit = limit;
+    }
+
+    // growing: fill the new slots from the queue
+    fill_free_slots();
+    return true;
+}
+
+/******************************************************************************
+ * Admission control
+ ******************************************************************************/
+
+// the total= of the "some" line of a PSI file: microseconds some task stalled since boot
+bool read_stall_total(int fd, uint64_t* total)
+{
+    char buffer[256];
+    const ssize_t n = fd != -1 ? pread(fd, buffer, sizeof(buffer) - 1, 0) : -1;
+    if (n <= 0) {
+        return false;
+    }
+    buffer[n] = '\0';
+    return sscanf(buffer, "some avg10=%*f avg60=%*f avg300=%*f total=%" SCNu64, total) == 1;
+}
+
+double read_load_average(void)
+{
+    char buffer[128];
+    const ssize_t n = pread(loadavg_fd, buffer, sizeof(buffer) - 1, 0);
+    double load = 0;
+    if (n > 0) {
+        buffer[n] = '\0';
+        sscanf(buffer, "%lf", &load);
+    }
+    return load;
+}
+
+// opens the pressure files and takes the first reading, false if there is nothing to go on
+bool start_admission_control(void)
+{
+    cpu_pressure_fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+    memory_pressure_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+    loadavg_fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+    if (loadavg_fd == -1) {
+        return false;
+    }
+    pressure_read_ns = monotonic_ns();
+    read_stall_total(cpu_pressure_fd, &cpu_stall_us);
+    read_stall_total(memory_pressure_fd, &memory_stall_us);
+
+    admission_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_interval.tv_nsec = ADMISSION_INTERVAL_MS * 1000000L;
+    spec.it_value = spec.it_interval;
+    return admission_timer_fd != -1 && timerfd_settime(admission_timer_fd, 0, &spec, NULL) == 0;
+}
+
+// percent of the time since the last reading that the stall total grew by, 0 without PSI
+double stall_percent(int fd, uint64_t* last_total, int64_t elapsed_ns)
+{
+    uint64_t total;
+    if (!read_stall_total(fd, &total) || total < *last_total || elapsed_ns <= 0) {
+        return 0;
+    }
+    const double percent = (double)(total - *last_total) * 1000 * 100 / (double)elapsed_ns;
+    *last_total = total;
+    return percent;
+}
+
+// one step of the controller: shed jobs under memory pressure, hold the queue back while the
+// cpu is saturated, and let one more job in at a time while the machine has room to spare
+void adjust_admission(void)
+{
+    const int64_t now = monotonic_ns();
+    cpu_pressure = stall_percent(cpu_pressure_fd, &cpu_stall_us, now - pressure_read_ns);
+    memory_pressure = stall_percent(memory_pressure_fd, &memory_stall_us, now - pressure_read_ns);
+    load_per_cpu = read_load_average() / available_cpu_count;
+    pressure_read_ns = now;
+
+    const int running = (int)running_heap.length;
+    if (memory_pressure >= MEMORY_SHED_PERCENT) {
+        admit_limit = running > 1 ? running - 1 : 1;
+        // the stopped jobs go back to the front of the queue and resume once there is room again
+        while ((int)running_heap.length > admit_limit) {
+            const int victim = lowest_priority_index();
+            respond("memory pressure %.0f%%, stopping %d\n", memory_pressure, running_processes[victim]->pid);
+            if (!preempt_slot(victim, true)) {
+                break;
+            }
+        }
+    } else if (cpu_pressure >= CPU_BUSY_PERCENT || load_per_cpu >= 2) {
+        // running jobs carry on, they are just not replaced as they finish
+        admit_limit = admit_limit < running ? admit_limit : running;
+        if (admit_limit > 1) {
+            admit_limit--;
+        }
+    } else if (cpu_pressure < CPU_IDLE_PERCENT && memory_pressure < MEMORY_CALM_PERCENT && load_per_cpu < 1
+        && process_queue.length > 0 && running >= admit_limit && admit_limit < max_running) {
+        admit_limit++;
+    }
+    fill_free_slots();
+}
+
+void handle_admission_timer(void)
+{
+    uint64_t expirations;
+    if (read(admission_timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    adjust_admission();
+}
+
+/******************************************************************************
+ * Job timers
+ ******************************************************************************/
+
+bool has_limits(const process_record* p)
+{
+    return p->limits.timeout_ns != 0 || p->limits.cpu_limit_ns != 0 || p->limits.deadline_ns != 0;
+}
+
+void arm_timer_wheel(int64_t at)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = at / 1000000000;
+    spec.it_value.tv_nsec = at % 1000000000;
+    timerfd_settime(timer_wheel_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    armed_timer_ns = at;
+}
+
+void timer_insert(process_record* p, int64_t at)
+{
+    // an empty wheel starts over from now rather than from wherever it was last looked at
+    if (timer_count == 0) {
+        wheel_tick = monotonic_ns() / (TIMER_TICK_MS * 1000000);
+    }
+    // a time already past goes into the first bucket still to be looked at
+    int64_t tick = (at + TIMER_TICK_MS * 1000000 - 1) / (TIMER_TICK_MS * 1000000);
+    tick = tick > wheel_tick ? tick : wheel_tick;
+    const size_t bucket = (size_t)tick % TIMER_WHEEL_SLOTS;
+    p->timer_ns = at;
+    p->timer_bucket = bucket;
+    p->timer_prev = NULL;
+    p->timer_next = timer_wheel[bucket];
+    if (timer_wheel[bucket] != NULL) {
+        timer_wheel[bucket]->timer_prev = p;
+    }
+    timer_wheel[bucket] = p;
+    timer_count++;
+    if (armed_timer_ns == 0 || tick * TIMER_TICK_MS * 1000000 < armed_timer_ns) {
+        arm_timer_wheel(tick * TIMER_TICK_MS * 1000000);
+    }
+}
+
+// the timerfd is left as it is, waking up for a bucket that emptied only costs a look at it
+void timer_remove(process_record* p)
+{
+    if (p->timer_ns == 0) {
+        return;
+    }
+    if (p->timer_prev != NULL) {
+        p->timer_prev->timer_next = p->timer_next;
+    } else {
+        timer_wheel[p->timer_bucket] = p->timer_next;
+    }
+    if (p->timer_next != NULL) {
+        p->timer_next->timer_prev = p->timer_prev;
+    }
+    p->timer_ns = 0;
+    p->timer_prev = NULL;
+    p->timer_next = NULL;
+    timer_count--;
+}
+
+// the next time anything about a job's limits is due, 0 for never
+int64_t job_timer_due(const process_record* p)
+{
+    if (p->kill_at_ns != 0) {
+        return p->kill_at_ns;
+    }
+    if (p->pid <= 0 || p->status == TERMINATED || p->status == UNUSED) {
+        return 0;
+    }
+    int64_t due = INT64_MAX;
+    if (p->limits.timeout_ns != 0 && p->first_run_ns != 0) {
+        due = p->first_run_ns + p->limits.timeout_ns;
+    }
+    if (p->cpu_check_ns != 0 && p->status == RUNNING && p->cpu_check_ns < due) {
+        due = p->cpu_check_ns;
+    }
+    if (p->limits.deadline_ns != 0 && !p->deadline_missed && p->limits.deadline_ns < due) {
+        due = p->limits.deadline_ns;
+    }
+    return due != INT64_MAX ? due : 0;
+}
+
+void update_job_timer(process_record* p)
+{
+    const int64_t due = job_timer_due(p);
+    if (due != p->timer_ns) {
+        timer_remove(p);
+        if (due != 0) {
+            timer_insert(p, due);
+        }
+    }
+}
+
+// cpu used by the job's own process and the helpers of it we have reaped
+int64_t job_cpu_used_ns(const process_record* p)
+{
+    const int64_t own = job_cpu_ns(p->pid);
+    return (own > 0 ? own : 0) + (p->usage.user_us + p->usage.system_us) * 1000;
+}
+
+// set_status for a job with limits: its timeout starts with its first run, and its cpu can only
+// run out while it runs, no sooner than its wall time could use up what is left of it
+void job_status_changed(process_record* p, int64_t now)
+{
+    if (p->status == RUNNING && p->first_run_ns == 0) {
+        p->first_run_ns = now;
+        if (p->limits.timeout_ns != 0) {
+            journal_append(JOURNAL_LIMITS, p->pid, 0, now, (const char*)&p->limits, sizeof(p->limits), 0);
+        }
+    }
+    if (p->status == RUNNING && p->limits.cpu_limit_ns != 0) {
+        const int64_t left = p->limits.cpu_limit_ns - job_cpu_used_ns(p);
+        p->cpu_check_ns = now + (left > 0 ? left : 0);
+    }
+    update_job_timer(p);
+}
+
+// a limit ran out: SIGTERM now and SIGKILL once the -g grace is up, if it has not gone by then
+void expire_job(process_record* p, int64_t now)
+{
+    p->kill_at_ns = now + shutdown_grace_ms * 1000000;
+    trigger_kill(p);
+}
+
+void job_timer_fired(process_record* p, int64_t now)
+{
+    if (p->kill_at_ns != 0) {
+        if (p->kill_at_ns <= now) {
+            respond("[%d] %d ignored SIGTERM for %ld ms, killing it\n", p->index, p->pid, shutdown_grace_ms);
+            signal_job(p, SIGKILL);
+            trace_signal(p, SIGKILL);
+            p->kill_at_ns = 0;
+        }
+    } else if (p->limits.timeout_ns != 0 && p->first_run_ns != 0 && p->first_run_ns + p->limits.timeout_ns <= now) {
+        respond("[%d] %d timed out after %" PRId64 " ms\n", p->index, p->pid, p->limits.timeout_ns / 1000000);
+        expire_job(p, now);
+        return;
+    } else if (p->cpu_check_ns != 0 && p->cpu_check_ns <= now && p->status == RUNNING) {
+        const int64_t left = p->limits.cpu_limit_ns - job_cpu_used_ns(p);
+        if (left <= 0) {
+            respond("[%d] %d used up its %" PRId64 " ms of cpu\n", p->index, p->pid, p->limits.cpu_limit_ns / 1000000);
+            expire_job(p, now);
+            return;
+        }
+        p->cpu_check_ns = now + (left > TIMER_TICK_MS * 1000000 ? left : TIMER_TICK_MS * 1000000);
+    }
+    if (p->limits.deadline_ns != 0 && !p->deadline_missed && p->limits.deadline_ns <= now
+        && p->status != TERMINATED) {
+        respond("[%d] %d missed its deadline\n", p->index, p->pid);
+        p->deadline_missed = true;
+    }
+    update_job_timer(p);
+}
+
+// points the timerfd at the first bucket with anything in it, disarmed when the wheel is empty
+void arm_next_timer(void)
+{
+    for (int64_t tick = wheel_tick; timer_count > 0 && tick < wheel_tick + TIMER_WHEEL_SLOTS; tick++) {
+        if (timer_wheel[(size_t)tick % TIMER_WHEEL_SLOTS] != NULL) {
+            arm_timer_wheel(tick * TIMER_TICK_MS * 1000000);
+            return;
+        }
+    }
+    arm_timer_wheel(0);
+}
+
+// looks at every bucket from the last wakeup up to now, at most one turn of the wheel,
+// and handles what is due; what lies a turn or more ahead stays where it is
+void handle_timer_wheel(void)
+{
+    uint64_t expirations;
+    if (read(timer_wheel_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    const int64_t now = monotonic_ns();
+    const int64_t now_tick = now / (TIMER_TICK_MS * 1000000);
+    const int64_t last = now_tick - wheel_tick < TIMER_WHEEL_SLOTS ? now_tick : wheel_tick + TIMER_WHEEL_SLOTS - 1;
+    // gathered first, handling a job can put it straight back into the bucket being walked
+    process_record* due = NULL;
+    for (int64_t tick = wheel_tick; tick <= last; tick++) {
+        process_record* p = timer_wheel[(size_t)tick % TIMER_WHEEL_SLOTS];
+        while (p != NULL) {
+            process_record* const next = p->timer_next;
+            if (p->timer_ns <= now) {
+                timer_remove(p);
+                p->timer_next = due;
+                due = p;
+            }
+            p = next;
+        }
+    }
+    wheel_tick = now_tick + 1;
+    while (due != NULL) {
+        process_record* const p = due;
+        due = p->timer_next;
+        p->timer_next = NULL;
+        job_timer_fired(p, now);
+    }
+    arm_next_timer();
+}
+
+/******************************************************************************
+ * Job output
+ ******************************************************************************/
+
+process_record* record_at(size_t index)
+{
+    const size_t slab = index / RECORD_SLAB_SIZE;
+    return slab < record_slab_count ? &process_records[slab][index % RECORD_SLAB_SIZE] : NULL;
+}
+
+void log_path(char* path, size_t size, pid_t pid)
+{
+    snprintf(path, size, "%s/%d.log", log_dir, pid);
+}
+
+void close_output(process_record* pr)
+{
+    // closing the pipe also takes it out of the epoll set
+    if (pr->output_fd != -1) {
+        close(pr->output_fd);
+        pr->output_fd = -1;
+    }
+    if (pr->log_fd != -1) {
+        close(pr->log_fd);
+        pr->log_fd = -1;
+    }
+}
+
+// moves whatever the job has written into its log, page by page inside the kernel with splice
+void drain_output(process_record* pr)
+{
+    while (pr->output_fd != -1) {
+        const bool keep = pr->log_fd != -1 && pr->log_bytes < LOG_LIMIT;
+        const int target = keep ? pr->log_fd : discard_fd;
+        const size_t chunk = keep && LOG_LIMIT - pr->log_bytes < (1 << 20) ? (size_t)(LOG_LIMIT - pr->log_bytes) : 1 << 20;
+        ssize_t n = splice(pr->output_fd, NULL, target, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == -1 && errno == EINVAL) {
+            // the log's filesystem cannot splice, copy through a buffer instead
+            char buffer[65536];
+            n = read(pr->output_fd, buffer, chunk < sizeof(buffer) ? chunk : sizeof(buffer));
+            if (n > 0 && !write_all(target, buffer, (size_t)n)) {
+                n = -1;
+            }
+        }
+        if (n > 0) {
+            pr->log_bytes += keep ? n : 0;
+        } else if (n == 0) {
+            // every writer is gone: the job and anything it started have exited
+            close_output(pr);
+        } else if (errno == EAGAIN) {
+            return;
+        } else if (errno != EINTR && keep) {
+            // the log cannot take any more, say so once and discard the rest. Leaving it unread
+            // would keep the pipe readable and the event loop spinning on it
+            respond("Unable to write the log of %d, discarding the rest of its output: %s\n", pr->pid, strerror(errno));
+            close(pr->log_fd);
+            pr->log_fd = -1;
+        } else if (errno != EINTR) {
+            respond("Unable to read the output of %d, no longer capturing it: %s\n", pr->pid, strerror(errno));
+            close_output(pr);
+        }
+    }
+}
+
+// gives a freshly spawned job's output pipe a log and starts watching it
+void attach_output(process_record* pr, int output_fd)
+{
+    pr->log_bytes = 0;
+    if (output_fd == -1) {
+        return;
+    }
+    char path[PATH_MAX];
+    log_path(path, sizeof(path), pr->pid);
+    pr->log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (pr->log_fd == -1) {
+        respond_error("Unable to open %s, output of %d is discarded: %s\n", path, pr->pid, strerror(errno));
+    }
+    pr->output_fd = output_fd;
+    fcntl(output_fd, F_SETFL, O_NONBLOCK);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = event_data(EVENT_OUTPUT, (size_t)pr->index);
+    epoll_ctl(manager_epoll_fd, EPOLL_CTL_ADD, output_fd, &ev);
+}
+
+void handle_output(size_t index)
+{
+    process_record* const pr = record_at(index);
+    if (pr != NULL) {
+        drain_output(pr);
+    }
+}
+
+/******************************************************************************
+ * Action Functions
+ ******************************************************************************/
+
+// limits may be NULL for none
+process_record* new_job_record(pid_t pid, int priority, int group, const job_limits* limits, int output_fd)
+{
+    process_record* const p = alloc_record();
+    p->pid = pid;
+    p->running_index = -1;
+    p->priority = priority;
+    p->group = group;
+    p->fair_tag = 0;
+    p->fair_charge = 0;
+    p->fair_run_ns = 0;
+    p->level = 0;
+    p->unmet_parents = 0;
+    memset(&p->usage, 0, sizeof(p->usage));
+    p->usage.start_ns = monotonic_ns();
+    p->adopted = false;
+    memset(&p->limits, 0, sizeof(p->limits));
+    if (limits != NULL) {
+        p->limits = *limits;
+    }
+    p->first_run_ns = 0;
+    p->cpu_check_ns = 0;
+    p->kill_at_ns = 0;
+    p->deadline_missed = false;
+    attach_output(p, output_fd);
+    pid_index_insert(p);
+    watch_event("spawned", p);
+
+    process_sample sample;
+    p->start_ticks = journal != NULL && sample_process(pid, &sample) ? sample.start_ticks : 0;
+    journal_append(JOURNAL_JOB, pid, priority, (int64_t)p->start_ticks, NULL, 0, 0);
+    if (has_limits(p)) {
+        journal_append(JOURNAL_LIMITS, pid, 0, 0, (const char*)&p->limits, sizeof(p->limits), 0);
+    }
+    journal_group(JOURNAL_GROUP, pid, p);
+    return p;
+}
+
+// registers a freshly spawned job, starting it if a slot is free and queueing it otherwise
+process_record* track_process(pid_t pid, int priority, int group, const job_limits* limits, int output_fd)
+{
+    const int running_index = find_free_slot();
+    process_record* const p = new_job_record(pid, priority, group, limits, output_fd);
+    if (running_index != -1) {
+        // a slot it takes without queueing still counts against its group's share
+        charge_group(p);
+        run_in_slot(p, running_index);
+    } else {
+        set_status(p, READY);
+        add_to_queue(p);
+        preempt_for_queue();
+    }
+    return p;
+}
+
+// starts a job without copying the manager's address space. A held job is spawned
+// as hold_and_exec with SIGCONT blocked, so the manager's SIGCONT releases it
+// into the real exec however early or late it arrives.
+// with -l the job's stdout and stderr both go into a new pipe whose read end comes back in output_fd
+pid_t spawn_job(char* args[], bool held, int* output_fd)
+{
+    *output_fd = -1;
+    const size_t len = strlen(args[0]);
+    char exec[len + 3];
+    strcpy(exec, "./");
+    strcat(exec, args[0]);
+    // a held job only execs later, catch a missing program now
+    if (access(exec, X_OK) != 0) {
+        return -1;
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask;
+    sigemptyset(&mask);
+    if (held) {
+        sigaddset(&mask, SIGCONT);
+    }
+    // the manager blocks SIGCHLD for its signalfd; don't leak that into the job
+    posix_spawnattr_setsigmask(&attr, &mask);
+    // and the ignored SIGPIPE
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    // its own process group, so stop, resume and kill reach everything it forks.
+    // With -J a session too: a group orphaned by the manager dying is sent SIGHUP if any of it is
+    // stopped, unless its new parent is in another session, and that would kill preempted jobs
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF
+        | (journal_path != NULL ? POSIX_SPAWN_SETSID : POSIX_SPAWN_SETPGROUP));
+
+    int output[2] = { -1, -1 };
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    // a background group reading the terminal would only be stopped by SIGTTIN
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (log_dir != NULL) {
+        if (pipe2(output, O_CLOEXEC) == -1) {
+            posix_spawn_file_actions_destroy(&actions);
+            posix_spawnattr_destroy(&attr);
+            return -1;
+        }
+        posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, output[1], STDERR_FILENO);
+    }
+
+    pid_t pid;
+    int error;
+    const int64_t started = monotonic_ns();
+    if (held) {
+        size_t argc = 0;
+        while (args[argc] != NULL) {
+            argc++;
+        }
+        char* hold_args[argc + 3];
+        hold_args[0] = (char*)hold_argv0;
+        hold_args[1] = exec;
+        memcpy(&hold_args[2], args, (argc + 1) * sizeof(char*));
+        error = posix_spawn(&pid, "/proc/self/exe", &actions, &attr, hold_args, environ);
+    } else {
+        error = posix_spawn(&pid, exec, &actions, &attr, args, environ);
+    }
+    histogram_record(HISTOGRAM_SPAWN, monotonic_ns() - started);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (output[1] != -1) {
+        close(output[1]);
+    }
+    if (error != 0) {
+        if (output[0] != -1) {
+            close(output[0]);
+        }
+        errno = error;
+        return -1;
+    }
+    *output_fd = output[0];
+    trace(TRACE_SPAWN, pid, -1, held);
+    return pid;
+}
+
+// the held side of spawn_job: wait for the manager's SIGCONT, then become the job
+int hold_and_exec(char* argv[])
+{
+    sigset_t cont;
+    sigemptyset(&cont);
+    sigaddset(&cont, SIGCONT);
+    while (sigwaitinfo(&cont, NULL) == -1) {
+    }
+
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    execv(argv[0], &argv[1]);
+    // Unreachable code unless execution failed.
+    return EXIT_FAILURE;
+}
+
+bool parse_int(const char* text, int* value)
+{
+    if (text == NULL) {
+        return false;
+    }
+    char* end;
+    const long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < INT_MIN || parsed > INT_MAX) {
+        return false;
+    }
+    *value = (int)parsed;
+    return true;
+}
+
+/******************************************************************************
+ * Job dependencies
+ ******************************************************************************/
+
+// an adopted job's exit status is unknown, so nothing waiting on it may assume it went well
+bool job_succeeded(const process_record* p)
+{
+    return p->usage.end_ns != 0 && !p->adopted && WIFEXITED(p->usage.exit_status) && WEXITSTATUS(p->usage.exit_status) == 0;
+}
+
+void add_dependent(process_record* parent, process_record* child)
+{
+    if (parent->dependent_count == parent->dependent_capacity) {
+        parent->dependent_capacity = parent->dependent_capacity == 0 ? 4 : parent->dependent_capacity * 2;
+        parent->dependents = (process_record**)realloc(parent->dependents, parent->dependent_capacity * sizeof(process_record*));
+        if (parent->dependents == NULL) {
+            fprintf(stderr, "unable to grow a dependency list\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    parent->dependents[parent->dependent_count++] = child;
+}
+
+// looks up -d's comma separated pids into parents, which has room for one per comma plus one.
+// Returns how many are still to finish, or -1 after replying if one is unknown or has failed
+int find_parents(char* list, process_record* parents[])
+{
+    int unmet = 0;
+    char* save = NULL;
+    for (char* item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        int pid;
+        process_record* const parent = parse_int(item, &pid) && pid > 0 ? pid_index_find(pid) : NULL;
+        if (parent == NULL || parent->array != NULL) {
+            respond_error("Unable to locate process with pid %s\n", item);
+            return -1;
+        }
+        if (job_succeeded(parent)) {
+            continue;
+        }
+        // killed jobs are TERMINATED before they are reaped, and cannot succeed either
+        if (parent->status == TERMINATED) {
+            respond_error("Process %d failed, nothing can depend on it\n", parent->pid);
+            return -1;
+        }
+        parents[unmet++] = parent;
+    }
+    return unmet;
+}
+
+// a job finished: queue the dependents it was the last parent of, or cancel them all if it failed.
+// A cancelled job's own reap then cancels whatever depends on it in turn
+void release_dependents(process_record* pr)
+{
+    const bool succeeded = job_succeeded(pr);
+    for (size_t i = 0; i < pr->dependent_count; i++) {
+        process_record* const d = pr->dependents[i];
+        // already cancelled through another parent
+        if (d->status != WAITING) {
+            continue;
+        }
+        if (!succeeded) {
+            respond("%d failed, cancelling %d\n", pr->pid, d->pid);
+            trigger_kill(d);
+        } else if (--d->unmet_parents == 0) {
+            set_status(d, READY);
+            add_to_queue(d);
+        }
+    }
+    pr->dependent_count = 0;
+}
+
+/******************************************************************************
+ * Job arrays
+ ******************************************************************************/
+
+// reads a..b or {x,y,...} into arg, false for a plain argument
+bool parse_array_argument(const char* text, array_argument* arg)
+{
+    memset(arg, 0, sizeof(*arg));
+    const size_t length = strlen(text);
+    if (length >= 3 && text[0] == '{' && text[length - 1] == '}' && strchr(text, ',') != NULL) {
+        arg->text = strndup(text + 1, length - 2);
+        arg->count = 1;
+        for (const char* c = arg->text; *c != '\0'; c++) {
+            arg->count += *c == ',';
+        }
+        arg->values = (char**)malloc(arg->count * sizeof(char*));
+        if (arg->text == NULL || arg->values == NULL) {
+            fprintf(stderr, "unable to allocate a job array\n");
+            exit(EXIT_FAILURE);
+        }
+        char* value = arg->text;
+        for (size_t i = 0; i < arg->count; i++) {
+            arg->values[i] = value;
+            value += strcspn(value, ",");
+            *value++ = '\0';
+        }
+        return true;
+    }
+
+    char* end;
+    errno = 0;
+    const long first = strtol(text, &end, 10);
+    if (end == text || strncmp(end, "..", 2) != 0) {
+        return false;
+    }
+    const char* const second = end + 2;
+    const long last = strtol(second, &end, 10);
+    if (end == second || *end != '\0' || errno != 0 || last < first) {
+        return false;
+    }
+    arg->first = first;
+    arg->count = (size_t)(last - first) + 1;
+    return true;
+}
+
+void free_job_array(job_array* a)
+{
+    for (int i = 0; i < a->argc; i++) {
+        free(a->args[i].text);
+        free(a->args[i].values);
+    }
+    free(a->args);
+    free(a->source);
+    free(a);
+}
+
+// NULL when no argument after the program expands, or when there would be too many tasks
+job_array* create_job_array(char* args[], bool* too_large)
+{
+    int argc = 0;
+    size_t source_length = 0;
+    while (args[argc] != NULL) {
+        source_length += strlen(args[argc++]) + 1;
+    }
+    job_array* const a = (job_array*)calloc(1, sizeof(job_array));
+    array_argument* const parsed = (array_argument*)calloc((size_t)argc, sizeof(array_argument));
+    char* const source = (char*)malloc(source_length);
+    if (a == NULL || parsed == NULL || source == NULL) {
+        fprintf(stderr, "unable to allocate a job array\n");
+        exit(EXIT_FAILURE);
+    }
+    a->source = source;
+    a->source_length = 0;
+    for (int i = 0; i < argc; i++) {
+        const size_t size = strlen(args[i]) + 1;
+        memcpy(source + a->source_length, args[i], size);
+        a->source_length += size;
+    }
+    a->args = parsed;
+    a->argc = argc;
+    a->count = 1;
+    bool expands = false;
+    *too_large = false;
+    for (int i = 0; i < argc; i++) {
+        if (i == 0 || !parse_array_argument(args[i], &parsed[i])) {
+            parsed[i].text = strdup(args[i]);
+            parsed[i].count = 1;
+            if (parsed[i].text == NULL) {
+                fprintf(stderr, "unable to allocate a job array\n");
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        expands = true;
+        if (parsed[i].count > (size_t)INT_MAX / a->count) {
+            *too_large = true;
+        } else {
+            a->count *= parsed[i].count;
+        }
+    }
+    if (!expands || *too_large) {
+        free_job_array(a);
+        return NULL;
+    }
+    return a;
+}
+
+// spawns the placeholder's next task straight into a free slot and requeues the placeholder
+// with its place in line kept while tasks remain; returns the task, NULL if it could not start
+process_record* start_array_task(process_record* placeholder)
+{
+    job_array* const a = placeholder->array;
+    char numbers[a->argc][24];
+    char* argv[a->argc + 1];
+    size_t task = a->next++;
+    for (int i = a->argc - 1; i >= 0; i--) {
+        const array_argument* const arg = &a->args[i];
+        const size_t value = task % arg->count;
+        task /= arg->count;
+        if (arg->values != NULL) {
+            argv[i] = arg->values[value];
+        } else if (arg->text == NULL) {
+            snprintf(numbers[i], sizeof(numbers[i]), "%ld", arg->first + (long)value);
+            argv[i] = numbers[i];
+        } else {
+            argv[i] = arg->text;
+        }
+    }
+    argv[a->argc] = NULL;
+
+    int output_fd;
+    const pid_t pid = spawn_job(argv, false, &output_fd);
+    if (pid < 0) {
+        // whatever stopped this one will most likely stop the rest too
+        respond_error("[%d] unable to run %s: %s, dropping the remaining %zu tasks\n",
+            placeholder->index, argv[0], strerror(errno), a->count - a->next);
+        a->next = a->count;
+    }
+    // journaled before the task is, so a restart in between can not start it twice
+    journal_append(JOURNAL_ARRAY_NEXT, placeholder->index, 0, (int64_t)a->next, NULL, 0, 0);
+    process_record* task_record = NULL;
+    if (pid >= 0) {
+        task_record = new_job_record(pid, placeholder->priority, placeholder->group, &placeholder->limits, output_fd);
+        // its wait in the queue and its start tag are the array's
+        task_record->status = READY;
+        task_record->status_since = placeholder->status_since;
+        task_record->fair_tag = placeholder->fair_tag;
+        task_record->fair_charge = placeholder->fair_charge;
+    }
+
+    if (a->next < a->count) {
+        // each task is charged to the group like a job of its own
+        charge_group(placeholder);
+        heap_push(&process_queue, placeholder);
+    } else {
+        free_job_array(a);
+        free_record(placeholder);
+    }
+    return task_record;
+}
+
+// the queued placeholder standing for a job array's tasks not yet started
+process_record* new_array_record(job_array* a, int priority, int group, const job_limits* limits)
+{
+    process_record* const p = alloc_record();
+    p->pid = 0;
+    p->running_index = -1;
+    p->priority = priority;
+    p->group = group;
+    p->fair_tag = 0;
+    p->fair_charge = 0;
+    p->fair_run_ns = 0;
+    p->level = 0;
+    memset(&p->limits, 0, sizeof(p->limits));
+    if (limits != NULL) {
+        p->limits = *limits;
+    }
+    set_status(p, READY);
+    p->array = a;
+    return p;
+}
+
+// queues a job array as one placeholder and starts as many tasks as there are free slots
+void run_job_array(job_array* a, int priority, int group, const job_limits* limits)
+{
+    process_record* const p = new_array_record(a, priority, group, limits);
+    journal_append(JOURNAL_ARRAY, p->index, priority, 0, a->source, a->source_length, a->argc);
+    if (has_limits(p)) {
+        journal_append(JOURNAL_ARRAY_LIMITS, p->index, 0, 0, (const char*)&p->limits, sizeof(p->limits), 0);
+    }
+    journal_group(JOURNAL_ARRAY_GROUP, p->index, p);
+    // after the array, a replay has nothing to put in place before it
+    add_to_queue(p);
+    respond("[%d] array of %zu jobs queued\n", p->index, a->count);
+
+    // a free slot means nothing else is queued
+    fill_free_slots();
+    preempt_for_queue();
+}
+
+void perform_run(char* args[])
+{
+    int priority = 0;
+    int group = 0;
+    char* after = NULL;
+    job_limits limits = { 0, 0, 0 };
+    const char* const usage = "usage: run [-p priority] [-d pid,...] [-g group] [--timeout ms] [--cpu-limit ms] [--deadline ms] program [args...]\n";
+    while (args[0] != NULL && args[0][0] == '-') {
+        int ms = 0;
+        if (args[1] == NULL) {
+            respond_error(usage);
+            return;
+        } else if (strcmp(args[0], "-d") == 0) {
+            after = args[1];
+        } else if (strcmp(args[0], "-g") == 0) {
+            if ((group = find_group(args[1], true)) == -1) {
+                respond_error("There can be at most %d groups.\n", MAX_GROUPS);
+                return;
+            }
+        } else if (strcmp(args[0], "-p") == 0) {
+            if (!parse_int(args[1], &priority)) {
+                respond_error("The priority must be an integer.\n");
+                return;
+            }
+        } else if (strcmp(args[0], "--timeout") != 0 && strcmp(args[0], "--cpu-limit") != 0
+            && strcmp(args[0], "--deadline") != 0) {
+            respond_error(usage);
+            return;
+        } else if (!parse_int(args[1], &ms) || ms <= 0) {
+            respond_error("%s takes a positive number of milliseconds.\n", args[0]);
+            return;
+        } else if (args[0][2] == 't') {
+            limits.timeout_ns = (int64_t)ms * 1000000;
+        } else if (args[0][2] == 'c') {
+            limits.cpu_limit_ns = (int64_t)ms * 1000000;
+        } else {
+            // a deadline is relative to now, the job has that long to finish from being submitted
+            limits.deadline_ns = monotonic_ns() + (int64_t)ms * 1000000;
+        }
+        args += 2;
+    }
+    if (args[0] == NULL) {
+        respond_error(usage);
+        return;
+    }
+
+    // -d pid,...: the job waits, held, until all of those have exited successfully
+    size_t parent_capacity = 1;
+    for (const char* c = after; c != NULL && *c != '\0'; c++) {
+        parent_capacity += *c == ',';
+    }
+    process_record* parents[parent_capacity];
+    const int unmet = after != NULL ? find_parents(after, parents) : 0;
+    if (unmet < 0) {
+        return;
+    }
+
+    // arguments written a..b or {x,y,...} make one job per combination, spawned as slots free up
+    bool too_large;
+    job_array* const array = create_job_array(args, &too_large);
+    if (array != NULL && unmet > 0) {
+        respond_error("A job array cannot wait for other jobs.\n");
+        free_job_array(array);
+        return;
+    }
+    if (too_large) {
+        respond_error("A job array can have at most %d jobs.\n", INT_MAX);
+        return;
+    }
+    if (array != NULL) {
+        const size_t len = strlen(args[0]);
+        char exec[len + 3];
+        strcpy(exec, "./");
+        strcat(exec, args[0]);
+        if (access(exec, X_OK) != 0) {
+            respond_error("Unable to run %s: %s\n", args[0], strerror(errno));
+            free_job_array(array);
+            return;
+        }
+        run_job_array(array, priority, group, &limits);
+        return;
+    }
+
+    // queued jobs are held before their exec so they cannot run until a slot frees up
+    int output_fd;
+    const pid_t pid = spawn_job(args, unmet > 0 || find_free_slot() == -1, &output_fd);
+    if (pid < 0) {
+        respond_error("Unable to run %s: %s\n", args[0], strerror(errno));
+        return;
+    }
+    current_reply.pid = pid;
+    if (unmet > 0) {
+        process_record* const p = new_job_record(pid, priority, group, &limits, output_fd);
+        set_status(p, WAITING);
+        p->unmet_parents = unmet;
+        for (int i = 0; i < unmet; i++) {
+            add_dependent(parents[i], p);
+            journal_append(JOURNAL_DEPEND, p->pid, 0, parents[i]->pid, NULL, 0, 0);
+        }
+        respond("[%d] %d waiting for %d jobs\n", p->index, p->pid, unmet);
+        return;
+    }
+    process_record* const p = track_process(pid, priority, group, &limits, output_fd);
+    respond("[%d] %d %s\n", p->index, p->pid, p->status == RUNNING ? "running" : "queued");
+}
+
+void perform_kill(pid_t pid)
+{
+    if (pid <= 0) {
+        respond_error("The process ID must be a positive integer.\n");
+        return;
+    }
+    process_record* const p = pid_index_find(pid);
+    if (p == NULL) {
+        respond_error("Unable to locate process with pid %d\n", pid);
+        return;
+    }
+    // the slot is handed to the next job once the reaper sees this one exit
+    trigger_kill(p);
+}
+
+void trigger_kill(process_record* p)
+{
+
+    if (p->status != TERMINATED) {
+        signal_job(p, SIGTERM);
+        trace_signal(p, SIGTERM);
+        // stopped and queued jobs only act on the SIGTERM once continued
+        if (p->status != RUNNING) {
+            signal_job(p, SIGCONT);
+            trace_signal(p, SIGCONT);
+        }
+        if (p->status == READY) {
+            unlink_from_queue(p);
+        }
+        respond("[%d] %d killed\n", p->index, p->pid);
+        // it keeps its slot until it is reaped, but can no longer be picked to make room
+        if (p->status == RUNNING) {
+            heap_remove(&running_heap, p);
+        }
+        set_status(p, TERMINATED);
+        // now rather than once it is reaped, so jobs its group queues meanwhile are not charged for it
+        settle_group(p);
+        return;
+    }
+    respond_error("Process %d not found.\n", p->pid);
+}
+
+void perform_stop(pid_t pid)
+{
+    if (pid <= 0) {
+        respond_error("The process ID must be a positive integer.\n");
+        return;
+    }
+    // find the running process
+    process_record* const pr = pid_index_find(pid);
+    if (pr == NULL || pr->running_index == -1 || pr->status != RUNNING) {
+        respond_error("Unable to locate process with pid %d\n", pid);
+        return;
+    }
+    respond("stopping %d\n", pr->pid);
+    const int running_index = pr->running_index;
+    signal_job(pr, SIGSTOP);
+    trace(TRACE_STOP, pr->pid, running_index, 0);
+    set_status(pr, STOPPED);
+    pr->running_index = -1;
+    heap_remove(&running_heap, pr);
+    running_processes[running_index] = NULL;
+
+    // start next process automatically
+    fill_free_slots();
+}
+
+void perform_resume(pid_t pid)
+{
+    if (pid <= 0) {
+        respond_error("The process ID must be a positive integer.\n");
+        return;
+    }
+
+    process_record* const pr = pid_index_find(pid);
+    if (pr == NULL || pr->status == TERMINATED) {
+        respond_error("Unable to locate process with pid %d\n", pid);
+        return;
+    }
+    if (pr->status == RUNNING) {
+        respond_error("Process %d is already running\n", pid);
+        return;
+    }
+    if (pr->status == WAITING) {
+        respond_error("Process %d is waiting for the jobs it depends on\n", pid);
+        return;
+    }
+    if (pr->status == READY) {
+        unlink_from_queue(pr);
+    }
+    // find available running slot
+    int running_index = find_free_slot();
+
+    // if unable to find slot, free a slot by removing the lowest priority running process,
+    // unless everything running outranks this job
+    if (running_index == -1) {
+        running_index = lowest_priority_index();
+        // every slot can be held by killed jobs waiting to be reaped
+        if (running_index == -1 || outranks(running_processes[running_index], pr)
+            || !preempt_slot(running_index, true)) {
+            respond("%d queued behind jobs that run first\n", pr->pid);
+            set_status(pr, READY);
+            add_to_queue_front(pr);
+            return;
+        }
+    }
+
+    respond("resuming %d\n", pr->pid);
+    run_in_slot(pr, running_index);
+}
+
+void perform_priority(pid_t pid, char* args[])
+{
+    if (pid <= 0) {
+        respond_error("The process ID must be a positive integer.\n");
+        return;
+    }
+    int priority;
+    if (!parse_int(args[0], &priority)) {
+        respond_error("The priority must be an integer.\n");
+        return;
+    }
+    process_record* const pr = pid_index_find(pid);
+    if (pr == NULL || pr->status == TERMINATED) {
+        respond_error("Unable to locate process with pid %d\n", pid);
+        return;
+    }
+
+    pr->priority = priority;
+    journal_append(JOURNAL_PRIORITY, pr->pid, priority, 0, NULL, 0, 0);
+    if (pr->status == READY) {
+        heap_update(&process_queue, pr);
+    } else if (pr->running_index != -1) {
+        heap_update(&running_heap, pr);
+    }
+    respond("[%d] %d priority %d\n", pr->index, pr->pid, pr->priority);
+    preempt_for_queue();
+}
+
+void perform_quantum(char* args[])
+{
+    if (args[0] == NULL) {
+        if (mlfq) {
+            respond("Multi-level feedback queue, quanta");
+            for (int level = 0; level < MLFQ_LEVELS; level++) {
+                respond(" %ld", quantum_ms << level);
+            }
+            respond(" ms\n");
+        } else if (quantum_ms > 0) {
+            respond("Round robin quantum is %ld ms\n", quantum_ms);
+        } else {
+            respond("Round robin is off\n");
+        }
+        return;
+    }
+    // 0 turns round robin off, the feedback queue needs a quantum
+    int quantum;
+    if (!parse_int(args[0], &quantum) || quantum < (mlfq ? 1 : 0) || quantum > MAX_QUANTUM_MS) {
+        respond_error("The quantum must be from %d to %d milliseconds%s.\n", mlfq ? 1 : 0, MAX_QUANTUM_MS,
+            mlfq ? "" : ", 0 turns round robin off");
+        return;
+    }
+    quantum_ms = quantum;
+    // restart the slices of everything running under the new quantum
+    const int64_t now = monotonic_ns();
+    for (int i = 0; i < max_running; i++) {
+        if (running_processes[i] != NULL) {
+            start_slice(running_processes[i], now);
+        }
+    }
+    perform_quantum((char*[]) { NULL });
+}
+
+void perform_limit(char* args[])
+{
+    if (args[0] == NULL) {
+        respond("Running up to %d processes:", max_running);
+        for (int i = 0; i < max_running; i++) {
+            respond(" [%d] cpu %d", i, slot_cpus[i]);
+        }
+        respond("\n");
+        if (adaptive_admission) {
+            respond("Admitting %d, cpu pressure %.1f%%, memory pressure %.1f%%, load %.2f per cpu\n", admit_limit,
+                cpu_pressure, memory_pressure, load_per_cpu);
+        }
+        return;
+    }
+    int limit;
+    if (!parse_int(args[0], &limit) || limit <= 0 || limit > MAX_RUNNING_LIMIT) {
+        respond_error("The limit must be an integer from 1 to %d.\n", MAX_RUNNING_LIMIT);
+        return;
+    }
+    if (!resize_running_slots(limit)) {
+        respond_error("Unable to grow to %d running slots.\n", limit);
+        return;
+    }
+    respond("Running up to %d processes\n", max_running);
+}
+
+// group lists the groups and what they have had, group NAME WEIGHT sets NAME's weight,
+// adding the group if there is none by that name yet
+void perform_group(char* args[])
+{
+    if (args[0] == NULL) {
+        size_t running[group_count];
+        size_t queued[group_count];
+        int64_t slot_ns[group_count];
+        memset(running, 0, sizeof(running));
+        memset(queued, 0, sizeof(queued));
+        int64_t total_ns = 0;
+        const int64_t now = monotonic_ns();
+        for (size_t i = 0; i < group_count; i++) {
+            slot_ns[i] = groups[i].slot_ns;
+        }
+        // jobs still running have held their slot since they last started
+        for (int i = 0; i < max_running; i++) {
+            const process_record* const p = running_processes[i];
+            if (p != NULL) {
+                running[p->group]++;
+                slot_ns[p->group] += now - p->status_since;
+            }
+        }
+        for (size_t i = 0; i < process_queue.length; i++) {
+            const process_record* const p = process_queue.items[i];
+            queued[p->group] += p->array != NULL ? p->array->count - p->array->next : 1;
+        }
+        for (size_t i = 0; i < group_count; i++) {
+            total_ns += slot_ns[i];
+        }
+        for (size_t i = 0; i < group_count; i++) {
+            const job_group* const g = &groups[i];
+            respond("%s, weight %d, %zu running, %zu queued, %zu finished, cpu user %.3f s, sys %.3f s, %.1f%% of slot time\n",
+                g->name, g->weight, running[i], queued[i], g->finished, (double)g->user_us / 1e6,
+                (double)g->system_us / 1e6, total_ns > 0 ? 100.0 * (double)slot_ns[i] / (double)total_ns : 0.0);
+        }
+        return;
+    }
+    int weight;
+    if (args[1] == NULL) {
+        respond_error("usage: group [name weight]\n");
+        return;
+    }
+    if (!parse_int(args[1], &weight) || weight <= 0 || weight > MAX_GROUP_WEIGHT) {
+        respond_error("The weight must be an integer from 1 to %d.\n", MAX_GROUP_WEIGHT);
+        return;
+    }
+    const int group = find_group(args[0], true);
+    if (group == -1) {
+        respond_error("There can be at most %d groups.\n", MAX_GROUPS);
+        return;
+    }
+    // jobs already queued keep their place, the new weight sets the pace from here on
+    groups[group].weight = weight;
+    journal_append(JOURNAL_WEIGHT, 0, weight, 0, groups[group].name, strlen(groups[group].name) + 1, 1);
+    respond("Group %s has weight %d\n", groups[group].name, weight);
+}
+
+void perform_list(void)
+{
+    bool anything = false;
+    for (size_t slab = 0; slab < record_slab_count; ++slab) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; ++i) {
+            process_record* const p = &process_records[slab][i];
+            if (p->array != NULL) {
+                respond("[%d] %s array, %zu of %zu jobs queued, %d\n", p->index, p->array->args[0].text,
+                    p->array->count - p->array->next, p->array->count, p->priority);
+                anything = true;
+            } else if (p->status == TERMINATED && p->usage.end_ns != 0) {
+                respond("%d, %d, %d, %" PRId64 ", %ld\n", p->pid, p->status, p->priority,
+                    (p->usage.user_us + p->usage.system_us) / 1000, p->usage.max_rss_kb);
+                anything = true;
+            } else if (p->status != UNUSED) {
+                process_sample sample;
+                if (sample_process(p->pid, &sample)) {
+                    respond("%d, %d, %d, %" PRId64 ", %ld\n", p->pid, p->status, p->priority,
+                        (sample.user_us + sample.system_us) / 1000, sample.rss_kb);
+                } else {
+                    respond("%d, %d, %d, -, -\n", p->pid, p->status, p->priority);
+                }
+                anything = true;
+            }
+        }
+    }
+    if (!anything) {
+        respond("No processes to list.\n");
+    }
+}
+
+// metrics [json] replies with the latency histograms, metrics FILE writes them to FILE instead,
+// as JSON when it ends in .json
+void perform_metrics(char* args[])
+{
+    const char* const path = args[0] != NULL && strcmp(args[0], "json") != 0 ? args[0] : NULL;
+    const size_t path_length = path != NULL ? strlen(path) : 0;
+    const bool json = path != NULL ? path_length >= 5 && strcmp(path + path_length - 5, ".json") == 0 : args[0] != NULL;
+
+    char* text = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    if (json) {
+        format_metrics_json(&text, &length, &capacity);
+    } else {
+        format_metrics_prometheus(&text, &length, &capacity);
+    }
+    if (path == NULL) {
+        respond("%s", text);
+        free(text);
+        return;
+    }
+    if (write_file_atomically(path, text, length)) {
+        respond("Metrics written to %s\n", path);
+    } else {
+        respond_error("Unable to write %s: %s\n", path, strerror(errno));
+    }
+    free(text);
+}
+
+// trace FILE writes the scheduling events still in the ring as Chrome trace JSON
+void perform_trace(char* args[])
+{
+    if (args[0] == NULL) {
+        const uint64_t kept = trace_head < TRACE_RING_SIZE ? trace_head : TRACE_RING_SIZE;
+        respond("%" PRIu64 " of %" PRIu64 " trace events kept, usage: trace file\n", kept, trace_head);
+        return;
+    }
+    char* text = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    format_trace_json(&text, &length, &capacity);
+    if (write_file_atomically(args[0], text, length)) {
+        respond("Trace written to %s\n", args[0]);
+    } else {
+        respond_error("Unable to write %s: %s\n", args[0], strerror(errno));
+    }
+    free(text);
+}
+
+// logs <pid> replies with the job's captured output, tail <pid> [lines] with its last lines
+void perform_logs(pid_t pid, char* args[], bool tail)
+{
+    int lines = 10;
+    if (pid <= 0) {
+        respond_error("The process ID must be a positive integer.\n");
+        return;
+    }
+    if (tail && args[0] != NULL && (!parse_int(args[0], &lines) || lines <= 0)) {
+        respond_error("The number of lines must be a positive integer.\n");
+        return;
+    }
+    if (log_dir == NULL) {
+        respond_error("Job output is not captured, start the manager with -l dir\n");
+        return;
+    }
+    process_record* const p = pid_index_find(pid);
+    if (p == NULL) {
+        respond_error("Unable to locate process with pid %d\n", pid);
+        return;
+    }
+    // bring the log up to date with whatever is still sitting in the pipe
+    drain_output(p);
+
+    char path[PATH_MAX];
+    log_path(path, sizeof(path), pid);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    const off_t size = fd != -1 ? lseek(fd, 0, SEEK_END) : -1;
+    if (size < 0) {
+        respond_error("Unable to read %s: %s\n", path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    const size_t length = size < LOG_REPLY_LIMIT ? (size_t)size : LOG_REPLY_LIMIT;
+    char* const text = (char*)malloc(length + 1);
+    if (text == NULL) {
+        fprintf(stderr, "unable to allocate a log buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    const ssize_t n = pread(fd, text, length, size - (off_t)length);
+    close(fd);
+    const size_t got = n > 0 ? (size_t)n : 0;
+
+    size_t start = 0;
+    if (tail) {
+        // walk back over the requested number of line ends, ignoring one that ends the log
+        start = got;
+        int seen = 0;
+        while (start > 0) {
+            if (text[start - 1] == '\n' && start != got && ++seen == lines) {
+                break;
+            }
+            start--;
+        }
+    } else if ((size_t)size > length) {
+        respond("... %jd earlier bytes not shown\n", (intmax_t)((size_t)size - length));
+    }
+    if (got > start) {
+        respond("%.*s%s", (int)(got - start), text + start, text[got - 1] == '\n' ? "" : "\n");
+    } else {
+        respond("No output from %d yet\n", pid);
+    }
+    if (p->log_bytes >= LOG_LIMIT) {
+        respond("... output past %d bytes was discarded\n", LOG_LIMIT);
+    }
+    free(text);
+}
+
+// watch streams job events to the client as lines of JSON: first a snapshot event for every live job
+// and a watching line, then every change as it happens, numbered on from the snapshot's seq.
+// watch off stops the stream
+void perform_watch(char* args[])
+{
+    client* const c = current_client;
+    if (args[0] != NULL && strcmp(args[0], "off") == 0) {
+        if (c->watching) {
+            c->watching = false;
+            watcher_count--;
+        }
+        respond("Stopped watching\n");
+        return;
+    }
+    if (c->watching) {
+        respond_error("Already watching\n");
+        return;
+    }
+    // whatever happened before this command goes to the other watchers, the snapshot already shows it
+    flush_watch();
+    size_t jobs = 0;
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            const process_record* const p = &process_records[slab][i];
+            if (p->status != UNUSED && p->array == NULL && p->usage.end_ns == 0) {
+                format_job_event(&reply_text, &reply_text_length, &reply_text_capacity, watch_sequence, "snapshot", p);
+                jobs++;
+            }
+        }
+    }
+    respond("{\"seq\":%" PRIu64 ",\"event\":\"watching\",\"jobs\":%zu,\"queued\":%zu}\n", watch_sequence, jobs,
+        process_queue.length);
+    c->watching = true;
+    watcher_count++;
+}
+
+void perform_stats(pid_t pid)
+{
+    if (pid <= 0) {
+        respond_error("The process ID must be a positive integer.\n");
+        return;
+    }
+    process_record* const p = pid_index_find(pid);
+    if (p == NULL) {
+        respond_error("Unable to locate process with pid %d\n", pid);
+        return;
+    }
+    const process_usage* const u = &p->usage;
+    const int64_t end_ns = u->end_ns != 0 ? u->end_ns : monotonic_ns();
+    respond("[%d] %d, status %d, priority %d, wall %.3f s\n", p->index, p->pid, p->status, p->priority,
+        (double)(end_ns - u->start_ns) / 1e9);
+    if (mlfq && u->end_ns == 0) {
+        respond("  feedback level %d\n", p->level);
+    }
+    if (p->group != 0) {
+        respond("  group %s\n", groups[p->group].name);
+    }
+    if (has_limits(p)) {
+        respond("  limits");
+        if (p->limits.timeout_ns != 0) {
+            respond(" timeout %" PRId64 " ms", p->limits.timeout_ns / 1000000);
+        }
+        if (p->limits.cpu_limit_ns != 0) {
+            respond(" cpu %" PRId64 " ms", p->limits.cpu_limit_ns / 1000000);
+        }
+        if (p->limits.deadline_ns != 0) {
+            if (p->deadline_missed || end_ns > p->limits.deadline_ns) {
+                respond(" deadline missed");
+            } else if (u->end_ns != 0) {
+                respond(" deadline met");
+            } else {
+                respond(" deadline in %.3f s", (double)(p->limits.deadline_ns - end_ns) / 1e9);
+            }
+        }
+        respond("\n");
+    }
+
+    if (u->end_ns != 0 && p->adopted) {
+        respond("  adopted after a restart, exit code and usage unknown\n");
+        return;
+    }
+    if (u->end_ns != 0) {
+        if (WIFSIGNALED(u->exit_status)) {
+            respond("  killed by signal %d\n", WTERMSIG(u->exit_status));
+        } else {
+            respond("  exit code %d\n", WEXITSTATUS(u->exit_status));
+        }
+        respond("  cpu user %.3f s, sys %.3f s\n", (double)u->user_us / 1e6, (double)u->system_us / 1e6);
+        respond("  max rss %ld kB\n", u->max_rss_kb);
+        respond("  context switches %ld voluntary, %ld involuntary\n", u->voluntary_switches, u->involuntary_switches);
+        respond("  io %ld blocks in, %ld blocks out\n", u->blocks_in, u->blocks_out);
+        if (u->descendants > 0) {
+            respond("  includes %d orphaned descendants\n", u->descendants);
+        }
+        return;
+    }
+    if (u->exited) {
+        respond("  exited with code %d, waiting for its helpers to exit\n", u->exit_status);
+        return;
+    }
+    process_sample sample;
+    if (!sample_process(p->pid, &sample)) {
+        respond("  exited, not reaped yet\n");
+        return;
+    }
+    respond("  state %c, %ld threads\n", sample.state, sample.threads);
+    respond("  cpu user %.3f s, sys %.3f s\n", (double)sample.user_us / 1e6, (double)sample.system_us / 1e6);
+    respond("  rss %ld kB\n", sample.rss_kb);
+    respond("  page faults %ld minor, %ld major\n", sample.minor_faults, sample.major_faults);
+}
+
+// reaps whatever has exited without touching the slots, returns how many of our jobs finished
+int shutdown_reap(void)
+{
+    int reaped = 0;
+    process_record* pr;
+    while (reap_child(&pr) > 0) {
+        if (pr != NULL) {
+            set_status(pr, TERMINATED);
+            reaped++;
+        }
+    }
+    return reaped;
+}
+
+// reaps jobs as their SIGCHLD arrives until none of alive are left or the deadline passes,
+// returns how many are still alive. Adopted jobs are not our children, their pidfds say when they are gone
+int shutdown_wait(int alive, int64_t deadline)
+{
+    alive -= shutdown_reap();
+    while (alive > 0) {
+        const int64_t left = deadline - monotonic_ns();
+        if (left <= 0) {
+            break;
+        }
+        struct pollfd fds[adopted_count + 1];
+        process_record* watched[adopted_count + 1];
+        fds[0] = (struct pollfd) { child_signal_fd, POLLIN, 0 };
+        size_t count = 1;
+        for (size_t slab = 0; slab < record_slab_count && count <= adopted_count; slab++) {
+            for (int i = 0; i < RECORD_SLAB_SIZE && count <= adopted_count; i++) {
+                process_record* const p = &process_records[slab][i];
+                if (p->pidfd != -1) {
+                    watched[count] = p;
+                    fds[count++] = (struct pollfd) { p->pidfd, POLLIN, 0 };
+                }
+            }
+        }
+        poll(fds, count, (int)((left + 999999) / 1000000));
+        struct signalfd_siginfo info;
+        while (read(child_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        }
+        alive -= shutdown_reap();
+        for (size_t i = 1; i < count; i++) {
+            if (fds[i].revents != 0) {
+                adopted_exited(watched[i]);
+                set_status(watched[i], TERMINATED);
+                alive--;
+            }
+        }
+    }
+    return alive;
+}
+
+// signals every job whose group has not all been reaped yet, returns how many that was
+int signal_unreaped(int signal)
+{
+    int signalled = 0;
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            process_record* const p = &process_records[slab][i];
+            // an unreaped group is still ours, its id cannot have been reused
+            if (p->status == UNUSED || p->array != NULL || p->usage.end_ns != 0) {
+                continue;
+            }
+            signal_job(p, signal);
+            trace_signal(p, signal);
+            signalled++;
+        }
+    }
+    return signalled;
+}
+
+void remove_client(client* c);
+
+// gives every client until deadline to take the rest of its replies, without ever blocking on
+// one that stopped reading; whoever has not drained by then is dropped with them
+void shutdown_flush(int64_t deadline)
+{
+    while (true) {
+        struct pollfd fds[client_capacity + 1];
+        client* pending[client_capacity + 1];
+        size_t count = 0;
+        for (size_t i = 0; i < client_capacity; i++) {
+            if (clients[i] != NULL && clients[i]->out_length > 0) {
+                pending[count] = clients[i];
+                fds[count++] = (struct pollfd) { clients[i]->out_fd, POLLOUT, 0 };
+            }
+        }
+        const int64_t left = deadline - monotonic_ns();
+        if (count == 0 || left <= 0) {
+            for (size_t i = 0; i < count; i++) {
+                remove_client(pending[i]);
+            }
+            return;
+        }
+        poll(fds, count, (int)((left + 999999) / 1000000));
+        for (size_t i = 0; i < count; i++) {
+            if (fds[i].revents != 0) {
+                flush_replies(pending[i]);
+            }
+        }
+    }
+}
+
+// exit [grace_ms]: every job gets SIGTERM at once and the grace period to exit,
+// whatever is left then gets SIGKILL, and everything is reaped before we go
+void perform_exit(char* args[])
+{
+    long grace_ms = shutdown_grace_ms;
+    if (args != NULL && args[0] != NULL) {
+        char* end;
+        grace_ms = strtol(args[0], &end, 10);
+        if (end == args[0] || *end != '\0' || grace_ms < 0) {
+            respond_error("The grace period must be a non-negative number of milliseconds.\n");
+            return;
+        }
+    }
+    respond("Exiting... Terminating all processes.\n");
+    const int64_t started = monotonic_ns();
+
+    // nothing queued may start from here on
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            process_record* const p = &process_records[slab][i];
+            if (p->array != NULL) {
+                respond("[%d] Dropping %zu queued array jobs.\n", p->index, p->array->count - p->array->next);
+                free_job_array(p->array);
+                free_record(p);
+            }
+        }
+    }
+    process_queue.length = 0;
+
+    // stopped and held jobs only act on the SIGTERM once continued
+    int alive = signal_unreaped(SIGTERM);
+    signal_unreaped(SIGCONT);
+    respond("Sent SIGTERM to %d processes.\n", alive);
+    alive = shutdown_wait(alive, started + grace_ms * 1000000);
+    if (alive > 0) {
+        respond("%d processes still running after %ld ms, killing them.\n", alive, grace_ms);
+        signal_unreaped(SIGKILL);
+        alive = shutdown_wait(alive, monotonic_ns() + SHUTDOWN_KILL_WAIT_MS * 1000000);
+    }
+    if (alive > 0) {
+        respond("%d processes could not be reaped.\n", alive);
+    }
+
+    // keep the last of every job's output, its pipe is at EOF once the job is gone
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            process_record* const p = &process_records[slab][i];
+            drain_output(p);
+            if (p->status != UNUSED) {
+                free_record(p);
+            }
+        }
+    }
+    respond("All processes terminated in %.3f s. Goodbye!\n", (double)(monotonic_ns() - started) / 1e9);
+    // nothing is left for a restart to pick up
+    if (journal != NULL) {
+        journal_compact();
+    }
+
+    // whoever asked is waiting for this reply, give every client what is left of the grace period to read theirs
+    end_reply();
+    flush_watch();
+    const int64_t flush_deadline = started + grace_ms * 1000000;
+    const int64_t flush_least = monotonic_ns() + SHUTDOWN_FLUSH_MS * 1000000;
+    shutdown_flush(flush_deadline > flush_least ? flush_deadline : flush_least);
+    if (socket_path != NULL) {
+        unlink(socket_path);
+    }
+    exit(0);
+}
+
+/******************************************************************************
+ * Journal
+ ******************************************************************************/
+
+// grows the journal file and its mapping to hold at least needed bytes, false with errno set
+bool journal_grow(size_t needed)
+{
+    size_t size = journal_size;
+    while (size < needed) {
+        size += JOURNAL_CHUNK;
+    }
+    // the new space reads as zeroes, which is also where the journal ends
+    if (ftruncate(journal_fd, (off_t)size) == -1) {
+        return false;
+    }
+    void* const mapped = journal == NULL
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, journal_fd, 0)
+        : mremap(journal, journal_size, size, MREMAP_MAYMOVE);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    journal = (char*)mapped;
+    journal_size = size;
+    return true;
+}
+
+// appends one change to the journal. It is in the page cache as soon as this returns, so it
+// survives the manager being killed; journal_sync sees to it reaching the disk
+void journal_append(journal_type type, pid_t pid, int priority, int64_t value, const char* args, size_t args_length, int argc)
+{
+    if (journal == NULL) {
+        return;
+    }
+    const size_t length = (sizeof(journal_entry) + args_length + 7) & ~(size_t)7;
+    // keep room for the zero length after it
+    if (journal_length + length + sizeof(uint32_t) > journal_size
+        && !journal_grow(journal_length + length + sizeof(uint32_t))) {
+        fprintf(stderr, "unable to grow the journal %s: %s\n", journal_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    journal_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.type = (uint16_t)type;
+    entry.argc = (uint16_t)argc;
+    entry.pid = pid;
+    entry.priority = priority;
+    entry.value = value;
+    char* const at = journal + journal_length;
+    memcpy(at, &entry, sizeof(entry));
+    if (args_length > 0) {
+        memcpy(at + sizeof(entry), args, args_length);
+    }
+    // the length goes in last, a manager killed half way through leaves the journal ending before this entry
+    atomic_signal_fence(memory_order_release);
+    const uint32_t entry_length = (uint32_t)length;
+    memcpy(at, &entry_length, sizeof(entry_length));
+    journal_length += length;
+}
+
+// a job as it stands, so that replaying it needs nothing written before
+void journal_job(const process_record* p)
+{
+    if (p->array != NULL) {
+        journal_append(JOURNAL_ARRAY, p->index, p->priority, (int64_t)p->array->next, p->array->source,
+            p->array->source_length, p->array->argc);
+        if (has_limits(p)) {
+            journal_append(JOURNAL_ARRAY_LIMITS, p->index, 0, 0, (const char*)&p->limits, sizeof(p->limits), 0);
+        }
+        journal_group(JOURNAL_ARRAY_GROUP, p->index, p);
+        journal_sequence(p);
+        return;
+    }
+    journal_append(JOURNAL_JOB, p->pid, p->priority, (int64_t)p->start_ticks, NULL, 0, 0);
+    journal_append(JOURNAL_STATUS, p->pid, 0, p->status, NULL, 0, 0);
+    journal_sequence(p);
+    if (has_limits(p)) {
+        journal_append(JOURNAL_LIMITS, p->pid, 0, p->first_run_ns, (const char*)&p->limits, sizeof(p->limits), 0);
+    }
+    journal_group(JOURNAL_GROUP, p->pid, p);
+}
+
+int compare_sequence(const void* a, const void* b)
+{
+    const int64_t x = (*(process_record* const*)a)->sequence;
+    const int64_t y = (*(process_record* const*)b)->sequence;
+    return (x > y) - (x < y);
+}
+
+// writes the group weights and every live job to the journal: queued ones in queue order,
+// then what waits on what
+void journal_snapshot(void)
+{
+    for (size_t i = 0; i < group_count; i++) {
+        if (groups[i].weight != 1) {
+            journal_append(JOURNAL_WEIGHT, 0, groups[i].weight, 0, groups[i].name, strlen(groups[i].name) + 1, 1);
+        }
+    }
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            const process_record* const p = &process_records[slab][i];
+            if (p->status != UNUSED && p->status != READY && p->status != TERMINATED) {
+                journal_job(p);
+            }
+        }
+    }
+    process_record** const queued = (process_record**)malloc((process_queue.length + 1) * sizeof(process_record*));
+    if (queued == NULL) {
+        fprintf(stderr, "unable to allocate the journal snapshot\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(queued, process_queue.items, process_queue.length * sizeof(process_record*));
+    qsort(queued, process_queue.length, sizeof(process_record*), compare_sequence);
+    for (size_t i = 0; i < process_queue.length; i++) {
+        journal_job(queued[i]);
+    }
+    free(queued);
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            const process_record* const p = &process_records[slab][i];
+            for (size_t d = 0; d < p->dependent_count; d++) {
+                if (p->dependents[d]->status == WAITING) {
+                    journal_append(JOURNAL_DEPEND, p->dependents[d]->pid, 0, p->pid, NULL, 0, 0);
+                }
+            }
+        }
+    }
+}
+
+// rewrites the journal as just the live jobs, into a new file renamed over the old one
+// so a crash part way through still leaves the old journal in place
+void journal_compact(void)
+{
+    char path[strlen(journal_path) + 5];
+    snprintf(path, sizeof(path), "%s.new", journal_path);
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "unable to write the journal %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (journal != NULL) {
+        munmap(journal, journal_size);
+        close(journal_fd);
+    }
+    journal = NULL;
+    journal_fd = fd;
+    journal_size = 0;
+    if (!journal_grow(JOURNAL_CHUNK)) {
+        fprintf(stderr, "unable to write the journal %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memcpy(journal, journal_magic, sizeof(journal_magic));
+    journal_length = sizeof(journal_magic);
+    journal_snapshot();
+    // this one waits for the disk, the old journal is only replaced by a complete new one
+    if (msync(journal, journal_length, MS_SYNC) == -1 || rename(path, journal_path) == -1) {
+        fprintf(stderr, "unable to write the journal %s: %s\n", journal_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    journal_synced = journal_length;
+    journal_compacted_length = journal_length;
+}
+
+// once per event loop iteration: starts writeback of whatever the iteration appended without
+// waiting for it, and compacts a journal grown well past what is live
+void journal_sync(void)
+{
+    if (journal == NULL || journal_synced == journal_length) {
+        return;
+    }
+    const size_t page = (size_t)page_size_kb * 1024;
+    const size_t from = journal_synced / page * page;
+    msync(journal + from, journal_length - from, MS_ASYNC);
+    journal_synced = journal_length;
+    if (journal_length > JOURNAL_COMPACT_BYTES && journal_length > 2 * journal_compacted_length) {
+        journal_compact();
+    }
+}
+
+// an array being replayed, known by the id it had in the journal
+typedef struct replayed_array {
+    int32_t id;
+    process_record* placeholder;
+} replayed_array;
+
+process_record* find_replayed_array(replayed_array* arrays, size_t count, int32_t id)
+{
+    for (size_t i = count; i > 0; i--) {
+        if (arrays[i - 1].id == id) {
+            return arrays[i - 1].placeholder;
+        }
+    }
+    return NULL;
+}
+
+// an array's arguments as they follow its entry, NULL if the entry is damaged
+job_array* replay_array(const journal_entry* entry, const char* args, size_t args_length)
+{
+    char** const argv = (char**)malloc(((size_t)entry->argc + 1) * sizeof(char*));
+    char* const copy = (char*)malloc(args_length + 1);
+    if (argv == NULL || copy == NULL) {
+        fprintf(stderr, "unable to allocate a job array\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, args, args_length);
+    copy[args_length] = '\0';
+    size_t offset = 0;
+    int argc = 0;
+    while (argc < entry->argc && offset < args_length) {
+        argv[argc++] = copy + offset;
+        offset += strlen(copy + offset) + 1;
+    }
+    argv[argc] = NULL;
+    bool too_large;
+    job_array* const a = argc == entry->argc && argc > 0 ? create_job_array(argv, &too_large) : NULL;
+    free(argv);
+    free(copy);
+    return a;
+}
+
+// rebuilds the job table from a journal's entries, stopping at its end or the first damaged entry.
+// Records are only created here, nothing is queued or run until the jobs have been checked
+void replay_journal(const char* data, size_t size)
+{
+    replayed_array* arrays = NULL;
+    size_t array_count = 0;
+    size_t array_capacity = 0;
+    size_t offset = sizeof(journal_magic);
+    while (offset + sizeof(journal_entry) <= size) {
+        journal_entry entry;
+        memcpy(&entry, data + offset, sizeof(entry));
+        if (entry.length < sizeof(entry) || entry.length % 8 != 0 || entry.length > size - offset) {
+            break;
+        }
+        const char* const args = data + offset + sizeof(entry);
+        const size_t args_length = entry.length - sizeof(entry);
+        offset += entry.length;
+
+        process_record* p = entry.type == JOURNAL_ARRAY || entry.type == JOURNAL_ARRAY_NEXT
+                || entry.type == JOURNAL_ARRAY_LIMITS || entry.type == JOURNAL_ARRAY_GROUP
+                || entry.type == JOURNAL_ARRAY_SEQUENCE
+            ? find_replayed_array(arrays, array_count, entry.pid)
+            : entry.pid > 0 ? pid_index_find(entry.pid) : NULL;
+        if (entry.type == JOURNAL_JOB && entry.pid > 0) {
+            // a pid reused after the journal lost track of its last job
+            if (p != NULL) {
+                free_record(p);
+            }
+            p = new_job_record(entry.pid, entry.priority, 0, NULL, -1);
+            p->start_ticks = (uint64_t)entry.value;
+            p->status = READY;
+            p->sequence = ++next_sequence;
+        } else if (entry.type == JOURNAL_ARRAY) {
+            job_array* const a = replay_array(&entry, args, args_length);
+            if (a == NULL) {
+                continue;
+            }
+            a->next = (size_t)entry.value;
+            p = new_array_record(a, entry.priority, 0, NULL);
+            p->sequence = ++next_sequence;
+            if (array_count == array_capacity) {
+                array_capacity = array_capacity == 0 ? 16 : array_capacity * 2;
+                arrays = (replayed_array*)realloc(arrays, array_capacity * sizeof(replayed_array));
+                if (arrays == NULL) {
+                    fprintf(stderr, "unable to replay the journal\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            arrays[array_count++] = (replayed_array) { entry.pid, p };
+        } else if (entry.type == JOURNAL_WEIGHT && args_length > 0 && memchr(args, '\0', args_length) != NULL) {
+            const int group = find_group(args, true);
+            if (group != -1 && entry.priority > 0 && entry.priority <= MAX_GROUP_WEIGHT) {
+                groups[group].weight = entry.priority;
+            }
+        } else if (p == NULL) {
+            continue;
+        } else if (entry.type == JOURNAL_STATUS && entry.value == TERMINATED) {
+            free_record(p);
+        } else if (entry.type == JOURNAL_STATUS && entry.value >= RUNNING && entry.value <= WAITING) {
+            p->status = (process_status)entry.value;
+            p->sequence = ++next_sequence;
+        } else if (entry.type == JOURNAL_SEQUENCE || entry.type == JOURNAL_ARRAY_SEQUENCE) {
+            // jobs queued from here on go after, or ahead of, everything replayed
+            p->sequence = entry.value;
+            next_sequence = entry.value > next_sequence ? entry.value : next_sequence;
+            front_sequence = entry.value < front_sequence ? entry.value : front_sequence;
+        } else if (entry.type == JOURNAL_PRIORITY) {
+            p->priority = entry.priority;
+        } else if ((entry.type == JOURNAL_LIMITS || entry.type == JOURNAL_ARRAY_LIMITS) && args_length >= sizeof(job_limits)) {
+            // deadlines and first runs are CLOCK_MONOTONIC, which carries on across managers
+            memcpy(&p->limits, args, sizeof(job_limits));
+            p->first_run_ns = entry.type == JOURNAL_LIMITS ? entry.value : 0;
+        } else if ((entry.type == JOURNAL_GROUP || entry.type == JOURNAL_ARRAY_GROUP) && args_length > 0
+            && memchr(args, '\0', args_length) != NULL) {
+            const int group = find_group(args, true);
+            p->group = group != -1 ? group : 0;
+        } else if (entry.type == JOURNAL_DEPEND) {
+            process_record* const parent = pid_index_find((pid_t)entry.value);
+            if (parent != NULL) {
+                add_dependent(parent, p);
+            }
+        } else if (entry.type == JOURNAL_ARRAY_NEXT) {
+            p->array->next = (size_t)entry.value;
+            if (p->array->next >= p->array->count) {
+                free_job_array(p->array);
+                free_record(p);
+                for (size_t i = 0; i < array_count; i++) {
+                    arrays[i].placeholder = arrays[i].placeholder == p ? NULL : arrays[i].placeholder;
+                }
+            }
+        }
+    }
+    free(arrays);
+}
+
+// watches a replayed job's pidfd if it is still the process the journal saw start, false if it is gone.
+// The pidfd is opened first: it fails fast for a pid nobody has, and once open the pid cannot be
+// reused under us between checking its start time and watching it
+bool adopt_job(process_record* p)
+{
+    p->pidfd = pidfd_open(p->pid, 0);
+    if (p->pidfd == -1) {
+        return false;
+    }
+    process_sample sample;
+    if (!sample_process(p->pid, &sample) || sample.start_ticks != p->start_ticks || sample.state == 'Z') {
+        close(p->pidfd);
+        p->pidfd = -1;
+        return false;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = event_data(EVENT_ADOPTED, (size_t)p->index);
+    epoll_ctl(manager_epoll_fd, EPOLL_CTL_ADD, p->pidfd, &ev);
+    p->adopted = true;
+    p->usage.start_ns = monotonic_ns();
+    p->status_since = p->usage.start_ns;
+    adopted_count++;
+    return true;
+}
+
+void handle_adopted(size_t index)
+{
+    process_record* const pr = record_at(index);
+    if (pr == NULL || pr->pidfd == -1) {
+        return;
+    }
+    adopted_exited(pr);
+    respond("parent> Adopted child %d exited, its exit code is unknown.\n", pr->pid);
+    finish_job(pr);
+    fill_free_slots();
+    preempt_for_queue();
+}
+
+// takes up the jobs a replayed journal left: the ones that are gone are dropped, along with
+// whatever waited on them, the rest are adopted and queued, run or left stopped as they were
+void adopt_replayed_jobs(size_t* adopted, size_t* lost)
+{
+    *adopted = 0;
+    *lost = 0;
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            process_record* const p = &process_records[slab][i];
+            if (p->status == UNUSED || p->array != NULL) {
+                continue;
+            }
+            if (adopt_job(p)) {
+                ++*adopted;
+            } else {
+                // finished or died while we were down, how it went is unknown
+                p->status = TERMINATED;
+                ++*lost;
+            }
+        }
+    }
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            process_record* const p = &process_records[slab][i];
+            if (p->status != TERMINATED) {
+                continue;
+            }
+            for (size_t d = 0; d < p->dependent_count; d++) {
+                if (p->dependents[d]->status == WAITING) {
+                    respond("%d may have failed, cancelling %d\n", p->pid, p->dependents[d]->pid);
+                    trigger_kill(p->dependents[d]);
+                }
+            }
+            free_record(p);
+        }
+    }
+
+    // what still waits only waits for the parents that are still around
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            process_records[slab][i].unmet_parents = 0;
+        }
+    }
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            const process_record* const p = &process_records[slab][i];
+            for (size_t d = 0; d < p->dependent_count; d++) {
+                p->dependents[d]->unmet_parents += p->dependents[d]->status == WAITING;
+            }
+        }
+    }
+
+    for (size_t slab = 0; slab < record_slab_count; slab++) {
+        for (int i = 0; i < RECORD_SLAB_SIZE; i++) {
+            process_record* const p = &process_records[slab][i];
+            if (p->status == WAITING && p->unmet_parents == 0) {
+                p->status = READY;
+            }
+            const int running_index = p->status == RUNNING ? find_free_slot() : -1;
+            if (running_index != -1) {
+                run_in_slot(p, running_index);
+            } else if (p->status == RUNNING || p->status == READY) {
+                // held jobs stay held, and one that was running waits for a slot like any other
+                if (p->array == NULL) {
+                    signal_job(p, SIGSTOP);
+                    trace_signal(p, SIGSTOP);
+                }
+                p->status = READY;
+                heap_push(&process_queue, p);
+            }
+            // the limits of jobs run_in_slot did not go through set_status for
+            if (p->status != UNUSED && p->status != RUNNING && has_limits(p)) {
+                job_status_changed(p, monotonic_ns());
+            }
+        }
+    }
+    fill_free_slots();
+    preempt_for_queue();
+}
+
+// -J: replays what a previous manager left in the journal, if anything, then starts a fresh one
+void start_journal(void)
 {
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        latest_running[i] = -1;
+    const int64_t started = monotonic_ns();
+    size_t adopted = 0;
+    size_t lost = 0;
+    const int fd = open(journal_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    const bool replay = fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0;
+    if (replay) {
+        const size_t size = (size_t)st.st_size;
+        const char* const data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED || size < sizeof(journal_magic) || memcmp(data, journal_magic, sizeof(journal_magic)) != 0) {
+            fprintf(stderr, "%s is not a job journal\n", journal_path);
+            exit(EXIT_FAILURE);
+        }
+        replay_journal(data, size);
+        munmap((void*)data, size);
+        adopt_replayed_jobs(&adopted, &lost);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    journal_compact();
+    if (replay) {
+        respond("Recovered %zu jobs from %s in %.3f ms, %zu had exited\n", adopted, journal_path,
+            (double)(monotonic_ns() - started) / 1e6, lost);
     }
 }
-void trigger_kill(process_record* p);
-void perform_exit(void);
-void start_next_process(int running_index);
 
 /******************************************************************************
- * Queue and priority management
+ * Command ring
  ******************************************************************************/
 
-// priority manager: if any processes have terminated/ stopped, increases the priority of the remaining processes
-void priority_manager(int stoppedIndex)
+command_ring* create_command_ring(void)
 {
-    int current_priority = latest_running[stoppedIndex];
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        if (latest_running[i] > current_priority) {
-            latest_running[i]--;
-        }
+    command_ring* const ring = (command_ring*)mmap(NULL, sizeof(command_ring),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return NULL;
     }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->producer_waiting, 0);
+    atomic_init(&ring->consumer_sleeping, 0);
+    ring->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ring->space_fd = eventfd(0, EFD_CLOEXEC);
+    if (ring->doorbell_fd == -1 || ring->space_fd == -1) {
+        return NULL;
+    }
+    return ring;
+}
 
-    latest_running[stoppedIndex] = -1;
+void ring_copy_in(command_ring* ring, uint64_t position, const void* source, size_t length)
+{
+    const size_t offset = (size_t)(position & (COMMAND_RING_SIZE - 1));
+    const size_t first = length < COMMAND_RING_SIZE - offset ? length : COMMAND_RING_SIZE - offset;
+    memcpy(&ring->data[offset], source, first);
+    memcpy(ring->data, (const char*)source + first, length - first);
 }
 
-// returns a priority to the current task about to be done
-// higher priority is given to earlier tasks
-int priority_allocater(void)
+void ring_copy_out(const command_ring* ring, uint64_t position, void* destination, size_t length)
 {
-    bool tracker[MAX_RUNNING] = { false };
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        if (latest_running[i] >= 0 && latest_running[i] < MAX_RUNNING) {
-            tracker[latest_running[i]] = true;
-        }
-    }
-    // tracker will have true for the taken priorities, false for the not taken ones
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        if (!tracker[i]) {
-            return i;
-        }
-    }
-    return -1;
+    const size_t offset = (size_t)(position & (COMMAND_RING_SIZE - 1));
+    const size_t first = length < COMMAND_RING_SIZE - offset ? length : COMMAND_RING_SIZE - offset;
+    memcpy(destination, &ring->data[offset], first);
+    memcpy((char*)destination + first, ring->data, length - first);
 }
 
-int lowest_priority_index(void)
+void ring_signal(int fd)
 {
-    // there will no process with a lower priority than MAX_RUNNING
-    int current_running = -1;
-    int lowest_index = -1;
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        if (latest_running[i] != -1 && latest_running[i] > current_running) {
-            current_running = latest_running[i];
-            lowest_index = i;
-        }
+    const uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+        // the counter is already non-zero, the other side will wake up anyway
     }
-    return lowest_index;
 }
 
-void add_to_queue(process_record* pr)
+// terminal side: queues one message, blocking only while the ring is full
+bool ring_push(command_ring* ring, const void* message, uint32_t length)
 {
-    if (process_queue[add_index] != NULL) {
-        printf(
-            "Queue is full! Please increase MAX_PROCESSES\n");
+    const uint64_t needed = sizeof(length) + length;
+    if (needed > COMMAND_RING_SIZE) {
+        return false;
+    }
+    const uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (head + needed - atomic_load_explicit(&ring->tail, memory_order_acquire) > COMMAND_RING_SIZE) {
+        atomic_store(&ring->producer_waiting, 1);
+        if (head + needed - atomic_load(&ring->tail) > COMMAND_RING_SIZE) {
+            uint64_t count;
+            if (read(ring->space_fd, &count, sizeof(count)) != sizeof(count)) {
+                return false;
+            }
+        }
+        atomic_store(&ring->producer_waiting, 0);
+    }
+
+    ring_copy_in(ring, head, &length, sizeof(length));
+    ring_copy_in(ring, head + sizeof(length), message, length);
+    atomic_store_explicit(&ring->head, head + needed, memory_order_release);
+
+    // pairs with ring_prepare_sleep: either the manager sees the new head or we see it sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->consumer_sleeping, memory_order_relaxed)) {
+        ring_signal(ring->doorbell_fd);
     }
-    process_queue[add_index] = pr;
-    add_index = (add_index + 1) % MAX_QUEUE;
+    return true;
 }
 
-void add_to_queue_front(process_record* pr)
+// manager side: copies the next message into buffer, -1 when the ring is empty
+ssize_t ring_pop(command_ring* ring, void* buffer, size_t size)
 {
-    if (process_queue[rem_index] != NULL) {
-        rem_index = (rem_index - 1 < 0) ? MAX_QUEUE - 1 : (rem_index - 1);
+    const uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+        return -1;
+    }
+    uint32_t length;
+    ring_copy_out(ring, tail, &length, sizeof(length));
+    const size_t copied = length < size ? length : size;
+    ring_copy_out(ring, tail + sizeof(length), buffer, copied);
+    atomic_store_explicit(&ring->tail, tail + sizeof(length) + length, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->producer_waiting, memory_order_relaxed)) {
+        ring_signal(ring->space_fd);
     }
-    // if process_queue[rem_index] = NULL, it is the first item added to queue
-    process_queue[rem_index] = pr;
+    return (ssize_t)copied;
 }
 
-process_record* remove_from_queue(void)
+// manager side: announces it is about to block, false if a message is already waiting
+bool ring_prepare_sleep(command_ring* ring)
 {
-    if (process_queue[rem_index] == NULL) {
-        return NULL;
+    atomic_store(&ring->consumer_sleeping, 1);
+    if (atomic_load(&ring->head) != atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+        atomic_store(&ring->consumer_sleeping, 0);
+        return false;
     }
-    process_record* pr = process_queue[rem_index];
-    process_queue[rem_index] = NULL;
-    rem_index = (rem_index + 1) % MAX_QUEUE;
-    return pr;
+    return true;
 }
 
 /******************************************************************************
- * Auto-start next process
+ * Input helpers
  ******************************************************************************/
 
-void process_tracker(void)
+void print_prompt(void)
 {
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        if (running_processes[i] == NULL) {
-            continue;
-        }
-
-        pid_t pid = running_processes[i]->pid;
-        if (pid > 0) {
-            int status;
-            if (waitpid(pid, &status, WNOHANG) == pid) {
-                printf("parent> Child %d exited with code %d.\n", pid, status);
-                running_processes[i]->status = TERMINATED;
-                running_processes[i] = NULL;
-                priority_manager(i);
+    printf(
+        "\x1B[34m"
+        "cs205"
+        "\x1B[0m"
+        "$ ");
+    fflush(stdout);
+}
 
-                // Start next process in the queue
-                start_next_process(i);
+// splits a line into words in place, returns the word count
+int split_words(char* line, char*** words, size_t* words_capacity)
+{
+    int count = 0;
+    char* save = NULL;
+    for (char* word = strtok_r(line, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save)) {
+        if ((size_t)count + 1 >= *words_capacity) {
+            *words_capacity = *words_capacity == 0 ? 16 : *words_capacity * 2;
+            *words = (char**)realloc(*words, *words_capacity * sizeof(char*));
+            if (*words == NULL) {
+                fprintf(stderr, "unable to grow the argument list\n");
+                exit(EXIT_FAILURE);
             }
         }
+        (*words)[count++] = word;
     }
+    return count;
 }
 
-/******************************************************************************
- * Helper Functions
- ******************************************************************************/
-
-void start_next_process(int running_index)
+bool send_command(int writing_pipe, command_ring* ring, const char* message, uint32_t length)
 {
-    process_record* next = remove_from_queue();
-    if (next != NULL) {
-        kill(next->pid, SIGCONT);
-        next->status = RUNNING;
-        running_processes[running_index] = next;
-        latest_running[running_index] = priority_allocater();
+    if (ring != NULL) {
+        return ring_push(ring, message, length);
     }
+    return write_all(writing_pipe, message, length);
 }
 
 /******************************************************************************
- * Action Functions
+ * Process Functions
  ******************************************************************************/
-
-void perform_run(char* args[])
+// sends one line of input as a command, its reply is picked up later by read_replies
+bool handle_line(terminal* t, char* line)
 {
-    // find a slot to run in
-    process_record* p = (process_record*)malloc(sizeof(process_record));
-    int running_index = -1;
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        if (running_processes[i] == NULL) {
-            running_index = i;
-            break;
-        }
+    int count = split_words(line, &t->words, &t->words_capacity);
+    if (count == 0) {
+        return true;
+    }
+    const command_name* const cmd = find_command(t->words[0]);
+    if (cmd == NULL) {
+        printf(
+            "invalid command. Valid commands are run, stop, resume, "
+            "kill, list, stats, logs, tail, watch, metrics, trace, priority, quantum, limit, "
+            "group and exit\n");
+        return true;
     }
 
-    int p_idx = -1;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_records[i] == NULL) {
-            p_idx = i;
-            break;
+    const uint32_t request_id = ++t->next_request_id;
+    const uint32_t length = encode_command(cmd, request_id, t->words, count, &t->message, &t->message_capacity);
+    if (length == 0) {
+        printf("command is too long\n");
+        return true;
+    }
+    if (!send_command(t->writing_pipe, t->ring, t->message, length)) {
+        printf("unable to write\n");
+        return false;
+    }
+    if (cmd->opcode == OP_EXIT) {
+        t->exit_request_id = request_id;
+    }
+    return true;
+}
+
+// sends every complete line read so far, holding the rest back while an exit is in flight
+void send_lines(terminal* t)
+{
+    // replies can arrive before any input has been read
+    if (t->input == NULL) {
+        return;
+    }
+    char* line = t->input;
+    char* newline;
+    bool sent = true;
+    while (sent && t->exit_request_id == 0 && (newline = strchr(line, '\n')) != NULL) {
+        *newline = '\0';
+        sent = handle_line(t, line);
+        line = newline + 1;
+        if (sent && t->exit_request_id == 0 && t->prompt) {
+            print_prompt();
         }
     }
-    pid_t pid = fork();
-    if (pid < 0) {
-        fprintf(stderr, "fork failed\n");
+    t->input_length -= (size_t)(line - t->input);
+    memmove(t->input, line, t->input_length + 1);
+    if (!sent) {
+        // the manager is gone, its reply pipe is about to say so too
+        t->input_done = true;
         return;
     }
-    if (pid == 0) {
-        const size_t len = strlen(args[0]);
-        char exec[len + 3];
-        strcpy(exec, "./");
-        strcat(exec, args[0]);
-        execvp(exec, args);
-        // Unreachable code unless execution failed.
-        exit(EXIT_FAILURE);
+
+    if (t->input_done && t->exit_request_id == 0) {
+        // end of input runs a last unterminated line and then exits, instead of waiting forever
+        if (t->input_length > 0) {
+            handle_line(t, t->input);
+            t->input_length = 0;
+            t->input[0] = '\0';
+        }
+        // without exit_at_eof, keep printing notifications until a client tells the manager to exit
+        if (t->exit_at_eof && t->exit_request_id == 0) {
+            char exit_line[] = "exit";
+            handle_line(t, exit_line);
+        }
     }
+}
 
-    if (kill(pid, SIGSTOP) == -1) {
-        fprintf(stderr, "Could not create child process %d\n", pid);
-        perform_exit();
-        exit(EXIT_FAILURE);
+void read_input(terminal* t)
+{
+    grow_buffer(&t->input, &t->input_capacity, t->input_length + 4096);
+    const ssize_t n = read(t->input_fd, t->input + t->input_length, t->input_capacity - t->input_length - 1);
+    if (n < 0 && errno == EINTR) {
+        return;
     }
-    p->pid = pid;
-    p->index = p_idx;
-    process_records[p_idx] = p;
-    if (running_index != -1) {
-        kill(p->pid, SIGCONT);
-        p->status = RUNNING;
-        running_processes[running_index] = p;
-        latest_running[running_index] = priority_allocater();
-        //        printf("[%d] %d currently running\n", p->index, p->pid);
+    if (n > 0) {
+        t->input_length += (size_t)n;
     } else {
-        p->status = READY;
-        add_to_queue(p);
+        t->input_done = true;
     }
+    t->input[t->input_length] = '\0';
+    send_lines(t);
 }
 
-void perform_kill(char* args[])
+// prints every complete reply, false once exit is confirmed or the manager has gone away
+bool read_replies(terminal* t)
 {
-    const pid_t pid = atoi(args[0]);
-    if (pid <= 0) {
-        printf("The process ID must be a positive integer.\n");
-        return;
+    grow_buffer(&t->replies, &t->replies_capacity, t->replies_length + 65536);
+    const ssize_t n = read(t->reply_pipe, t->replies + t->replies_length, t->replies_capacity - t->replies_length);
+    if (n <= 0) {
+        return n < 0 && errno == EINTR;
     }
-    int running_index = -1;
-    for (int i = 0; i < MAX_PROCESSES; ++i) {
-        process_record* const p = process_records[i];
-        if (p != NULL && p->pid == pid) {
-            running_index = i;
-            trigger_kill(p);
+    t->replies_length += (size_t)n;
+
+    size_t offset = 0;
+    bool done = false;
+    while (t->replies_length - offset >= sizeof(reply_header)) {
+        reply_header header;
+        memcpy(&header, t->replies + offset, sizeof(header));
+        if (t->replies_length - offset < header.length) {
             break;
         }
+        // the text is nul terminated
+        fputs(t->replies + offset + sizeof(header), stdout);
+        if (t->exit_request_id != 0 && header.request_id == t->exit_request_id) {
+            // a refused exit leaves the manager running, so carry on with the input
+            done = header.status == REPLY_OK;
+            t->exit_request_id = 0;
+        }
+        offset += header.length;
     }
-    if (running_index == -1) {
-        printf("Unable to locate process with pid %d\n", pid);
-        return;
+    fflush(stdout);
+    t->replies_length -= offset;
+    memmove(t->replies, t->replies + offset, t->replies_length);
+    if (!done && t->exit_request_id == 0) {
+        send_lines(t);
     }
-    start_next_process(running_index);
+    return !done;
 }
 
-void trigger_kill(process_record* p)
+void run_terminal(int input_fd, int writing_pipe, int reply_pipe, command_ring* ring, bool exit_at_eof)
 {
+    // reused for every command, the buffers only ever grow
+    terminal t;
+    memset(&t, 0, sizeof(t));
+    t.writing_pipe = writing_pipe;
+    t.reply_pipe = reply_pipe;
+    t.ring = ring;
+    t.exit_at_eof = exit_at_eof;
+    t.input_fd = input_fd;
+    t.prompt = !batch_mode;
 
-    if (p->status != TERMINATED) {
-        kill(p->pid, SIGTERM);
-        printf("[%d] %d killed\n", p->index, p->pid);
-        p->status = TERMINATED;
-        return;
+    // commands are pipelined, input keeps flowing while replies arrive whenever they are ready
+    if (t.prompt) {
+        print_prompt();
+    }
+    while (true) {
+        struct pollfd fds[2] = {
+            { !t.input_done && t.exit_request_id == 0 ? input_fd : -1, POLLIN, 0 },
+            { reply_pipe, POLLIN, 0 },
+        };
+        if (poll(fds, 2, -1) == -1) {
+            continue;
+        }
+        if (fds[1].revents != 0 && !read_replies(&t)) {
+            break;
+        }
+        if (fds[0].revents != 0) {
+            read_input(&t);
+        }
     }
-    printf("Process %d not found.\n", p->pid);
+    free(t.input);
+    free(t.words);
+    free(t.message);
+    free(t.replies);
 }
 
-void perform_stop(char* args[])
+void dispatch_command(const command_header* header, char* args[])
 {
-    const pid_t pid = atoi(args[0]);
-    if (pid <= 0) {
-        printf("The process ID must be a positive integer.\n");
+    current_reply.pid = header->pid;
+    switch (header->opcode) {
+    case OP_KILL:
+        perform_kill(header->pid);
+        break;
+    case OP_RUN:
+        perform_run(args);
+        break;
+    case OP_LIST:
+        perform_list();
+        break;
+    case OP_STATS:
+        perform_stats(header->pid);
+        break;
+    case OP_METRICS:
+        perform_metrics(args);
+        break;
+    case OP_TRACE:
+        perform_trace(args);
+        break;
+    case OP_LOGS:
+        perform_logs(header->pid, args, false);
+        break;
+    case OP_TAIL:
+        perform_logs(header->pid, args, true);
+        break;
+    case OP_RESUME:
+        perform_resume(header->pid);
+        break;
+    case OP_STOP:
+        perform_stop(header->pid);
+        break;
+    case OP_PRIORITY:
+        perform_priority(header->pid, args);
+        break;
+    case OP_QUANTUM:
+        perform_quantum(args);
+        break;
+    case OP_LIMIT:
+        perform_limit(args);
+        break;
+    case OP_EXIT:
+        perform_exit(args);
+        break;
+    case OP_WATCH:
+        perform_watch(args);
+        break;
+    case OP_GROUP:
+        perform_group(args);
+        break;
+    default:
+        respond_error("Unknown command %d\n", header->opcode);
+        break;
+    }
+}
+
+// checks that one whole message from c is well formed, then runs it with argv pointing into it
+void dispatch_message(client* c, char* message, size_t length)
+{
+    command_header header;
+    if (length < sizeof(header)) {
         return;
     }
-    // find the running process
-    process_record* pr = NULL;
-    int running_index = -1;
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        if (running_processes[i] == NULL) {
-            continue;
+    memcpy(&header, message, sizeof(header));
+
+    // anything said so far was a notification for the terminal, the reply to c starts fresh
+    end_reply();
+    current_client = c;
+    begin_reply(header.request_id);
+    if (header.length != length) {
+        respond_error("Malformed command\n");
+        end_reply();
+        current_client = NULL;
+        return;
+    }
+
+    if ((size_t)header.argc + 1 > command_args_capacity) {
+        command_args_capacity = (size_t)header.argc + 1 < 16 ? 16 : (size_t)header.argc + 1;
+        command_args = (char**)realloc(command_args, command_args_capacity * sizeof(char*));
+        if (command_args == NULL) {
+            fprintf(stderr, "unable to grow the argument list\n");
+            exit(EXIT_FAILURE);
         }
-        if (pid == running_processes[i]->pid) {
-            pr = running_processes[i];
-            running_index = i;
+    }
+    char* p = message + sizeof(header);
+    char* const end = message + length;
+    for (uint16_t i = 0; i < header.argc; i++) {
+        char* const terminator = p < end ? (char*)memchr(p, '\0', (size_t)(end - p)) : NULL;
+        if (terminator == NULL) {
+            respond_error("Malformed command\n");
+            end_reply();
+            current_client = NULL;
+            return;
         }
+        command_args[i] = p;
+        p = terminator + 1;
     }
+    command_args[header.argc] = NULL;
+    const int64_t started = monotonic_ns();
+    dispatch_command(&header, command_args);
+    histogram_record(HISTOGRAM_COMMAND, monotonic_ns() - started);
+    end_reply();
+    current_client = NULL;
+}
 
-    if (pr == NULL) {
-        printf("Unable to locate process with pid %d\n", pid);
-        return;
+client* add_client(int in_fd, int out_fd)
+{
+    size_t slot = 0;
+    while (slot < client_capacity && clients[slot] != NULL) {
+        slot++;
     }
-    printf("stopping %d\n", pr->pid);
-    kill(pr->pid, SIGSTOP);
-    pr->status = STOPPED;
-    priority_manager(running_index);
-    running_processes[running_index] = NULL;
+    if (slot == client_capacity) {
+        client_capacity = client_capacity == 0 ? 16 : client_capacity * 2;
+        clients = (client**)realloc(clients, client_capacity * sizeof(client*));
+        if (clients == NULL) {
+            fprintf(stderr, "unable to grow the client table\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(&clients[slot], 0, (client_capacity - slot) * sizeof(client*));
+    }
+    client* const c = (client*)calloc(1, sizeof(client));
+    if (c == NULL) {
+        fprintf(stderr, "unable to allocate a client\n");
+        exit(EXIT_FAILURE);
+    }
+    c->in_fd = in_fd;
+    c->out_fd = out_fd;
+    c->slot = slot;
 
-    // start next process automatically
-    start_next_process(running_index);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = event_data(EVENT_CLIENT, slot);
+    if (epoll_ctl(manager_epoll_fd, EPOLL_CTL_ADD, in_fd, &ev) == -1) {
+        free(c);
+        return NULL;
+    }
+    clients[slot] = c;
+    return c;
 }
 
-void perform_resume(char* args[])
+// drops a socket client along with any replies it never read; closing the fd leaves the epoll set too
+void remove_client(client* c)
 {
-    const pid_t pid = atoi(args[0]);
-    if (pid <= 0) {
-        printf("The process ID must be a positive integer.\n");
-        return;
+    if (c->watching) {
+        watcher_count--;
     }
+    clients[c->slot] = NULL;
+    close(c->in_fd);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
 
-    process_record* pr = NULL;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_records[i] != NULL) {
-            if (process_records[i]->pid == pid) {
-                pr = process_records[i];
-                break;
-            }
+// one read per wakeup: every complete message in it is dispatched, a partial one is kept
+void read_client(client* c)
+{
+    grow_buffer(&c->in, &c->in_capacity, c->in_length + 4096);
+    ssize_t bytes_read = read(c->in_fd, c->in + c->in_length, c->in_capacity - c->in_length);
+    if (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EINTR)) {
+        if (c == console) {
+            // terminal has gone away, nobody is left to drive the manager
+            perform_exit(NULL);
         }
-    }
-
-    if (pr == NULL) {
-        printf("Unable to locate process with pid %d\n", pid);
+        remove_client(c);
         return;
     }
-    if (pr->status == RUNNING) {
-        printf("Process %d is already running\n", pid);
+    if (bytes_read < 0) {
         return;
     }
-    // find available running slot
-    int running_index = -1;
-    for (int i = 0; i < MAX_RUNNING; i++) {
-        if (running_processes[i] == NULL) {
-            running_index = i;
+    c->in_length += (size_t)bytes_read;
+
+    size_t offset = 0;
+    while (c->in_length - offset >= sizeof(uint32_t)) {
+        uint32_t length;
+        memcpy(&length, c->in + offset, sizeof(length));
+        if (length < sizeof(command_header) || length > MAX_COMMAND_SIZE) {
+            // framing is lost, nothing after this point can be trusted
+            end_reply();
+            current_client = c;
+            respond_error("Malformed command stream, discarding %zu bytes\n", c->in_length - offset);
+            end_reply();
+            current_client = NULL;
+            offset = c->in_length;
             break;
         }
-    }
-
-    // if unable to find slot, free a slot by removing the lowest priority running process
-    if (running_index == -1) {
-        int to_stop_idx = lowest_priority_index();
-        process_record* to_stop = running_processes[to_stop_idx];
-        if (kill(to_stop->pid, SIGSTOP) != 0) {
-            printf("unable to stop\n");
+        if (c->in_length - offset < length) {
+            break;
         }
-        to_stop->status = READY;
-        add_to_queue_front(to_stop);
-        running_index = to_stop_idx;
+        dispatch_message(c, c->in + offset, length);
+        offset += length;
     }
-
-    printf("resuming %d\n", pr->pid);
-    kill(pr->pid, SIGCONT);
-    pr->status = RUNNING;
-    running_processes[running_index] = pr;
+    c->in_length -= offset;
+    memmove(c->in, c->in + offset, c->in_length);
 }
 
-void perform_list(void)
+void handle_client(size_t slot, uint32_t events)
 {
-    bool anything = false;
-    for (int i = 0; i < MAX_PROCESSES; ++i) {
-        process_record* const p = process_records[i];
-        if (p != NULL) {
-            printf("%d, %d\n", p->pid, p->status);
-            anything = true;
-        }
+    client* const c = slot < client_capacity ? clients[slot] : NULL;
+    if (c == NULL) {
+        // went away earlier in this batch of events
+        return;
     }
-    if (!anything) {
-        printf("No processes to list.\n");
+    if (events & (EPOLLOUT | EPOLLERR)) {
+        flush_replies(c);
+    }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        read_client(c);
     }
 }
-void perform_exit(void)
-{
-    printf("Exiting... Terminating all processes.\n");
-    fflush(stdout);
-
-    // Loop through all processes in process_records
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_records[i] != NULL) {
-            pid_t pid = process_records[i]->pid;
-
-            // If process is stopped, resume it first
-            printf("[%d]", i);
-            if (process_records[i]->status == STOPPED) {
-                printf("Resuming stopped process %d before termination.\n", pid);
-                kill(pid, SIGCONT);
-                usleep(50000); // Ensure process is resumed before killing
-            }
-            // Check if process is still alive before killing
-            if (kill(pid, 0) == 0) {
-                kill(pid, SIGTERM);
-                printf("Killing process %d.\n", pid);
-            } else {
-                printf("Process %d already terminated, skipping.\n", pid);
-            }
 
-            // Free memory for this process
-            free(process_records[i]);
-            process_records[i] = NULL;
+void handle_listen(void)
+{
+    int fd;
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        if (add_client(fd, fd) == NULL) {
+            close(fd);
         }
     }
+}
 
-    printf("All processes terminated. Goodbye!\n");
-    exit(0);
+// ring mode: messages are copied out one at a time into the terminal's input buffer
+void drain_command_ring(void)
+{
+    grow_buffer(&console->in, &console->in_capacity, MAX_COMMAND_SIZE);
+    ssize_t length;
+    while ((length = ring_pop(terminal_ring, console->in, MAX_COMMAND_SIZE)) >= 0) {
+        dispatch_message(console, console->in, (size_t)length);
+    }
 }
 
-/******************************************************************************
- * Input helpers
- ******************************************************************************/
+void handle_ring_doorbell(void)
+{
+    uint64_t count;
+    if (read(terminal_ring->doorbell_fd, &count, sizeof(count)) != sizeof(count)) {
+        // spurious wakeup, the ring is drained on every loop iteration anyway
+    }
+}
 
-void process_input(char* buffer, char* args[], int args_count_max)
+void handle_child_signal(int signal_fd)
 {
-    char* p = strtok(buffer, " ");
-    int arg_cnt = 0;
-    while (p != NULL) {
-        args[arg_cnt++] = p;
-        if (arg_cnt == args_count_max - 1) {
-            break;
-        }
-        p = strtok(NULL, " ");
+    // drain every queued notification, SIGCHLD is not a counting signal anyway
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
     }
-    args[arg_cnt] = NULL;
+    process_tracker();
 }
 
-char* get_input(char* buffer)
+void handle_slice_timer(void)
 {
-    // capture a command
-    printf(
-        "\x1B[34m"
-        "cs205"
-        "\x1B[0m"
-        "$ ");
-    fgets(buffer, 79, stdin);
-    for (char* c = buffer; *c != '\0'; ++c) {
-        if ((*c == '\r') || (*c == '\n')) {
-            *c = '\0';
-            break;
-        }
+    uint64_t expirations;
+    if (read(slice_timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
     }
-    strcat(buffer, " ");
-    char buffer2[80];
-    strcpy(buffer2, buffer);
-    // tokenize command's arguments and retrieve just the command
-    char* p = strtok(buffer2, " ");
-    char* result = (char*)malloc(21 * sizeof(char));
-    strcpy(result, p);
-    return result;
+    armed_slice_end = 0;
+    rotate_expired_slices();
 }
 
-bool valid_command(char cmd[])
+int create_child_signalfd(void)
 {
-    return strcmp(cmd, "kill") == 0 || strcmp(cmd, "run") == 0 || strcmp(cmd, "list") == 0 || strcmp(cmd, "resume") == 0 || strcmp(cmd, "stop") == 0 || strcmp(cmd, "exit") == 0;
+    // only report exits, stop/continue of our own jobs would just wake us up
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        return -1;
+    }
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
 }
 
-/******************************************************************************
- * Process Functions
- ******************************************************************************/
-void run_terminal(int writing_pipe)
+int watch_fd(int epoll_fd, int fd, enum event_source source)
 {
-    char buffer[80];
-    // NULL-terminated array
-    while (true) {
-        char* cmd = get_input(buffer);
-        if (valid_command(cmd)) {
-            if (write(writing_pipe, buffer, 80) <= 0) {
-                printf("unable to write\n");
-                break;
-            }
-            if (strcmp(cmd, "exit") == 0) {
-                sleep(5);
-                free(cmd);
-                break;
-            }
-        } else {
-            printf(
-                "invalid command. Valid commands are run, stop, resume, "
-                "kill, list "
-                "and exit\n");
-        }
-        free(cmd);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = event_data(source, 0);
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// listens on path for further clients, -1 if the socket could not be set up
+int create_listen_socket(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    // a socket left behind by a manager that did not exit cleanly
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        return -1;
     }
-    return;
+    return fd;
 }
 
-void run_process_manager(int reading_pipe)
+void run_process_manager(int reading_pipe, int writing_replies, int running_limit, command_ring* ring, int socket_fd)
 {
-    initialise();
+    terminal_ring = ring;
+    listen_fd = socket_fd;
+    initialise(running_limit);
+    if (adaptive_admission && !start_admission_control()) {
+        fprintf(stderr, "unable to read the system load for admission control\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const int signal_fd = create_child_signalfd();
+    child_signal_fd = signal_fd;
+    // helpers orphaned by a job are reparented to us rather than to init, so we can account for them
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+        fprintf(stderr, "unable to become a subreaper\n");
+        exit(EXIT_FAILURE);
+    }
+    slice_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    timer_wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    manager_epoll_fd = epoll_fd;
+    if (signal_fd == -1 || slice_timer_fd == -1 || timer_wheel_fd == -1 || epoll_fd == -1
+        || (console = add_client(reading_pipe, writing_replies)) == NULL
+        || (listen_fd != -1 && watch_fd(epoll_fd, listen_fd, EVENT_LISTEN) == -1)
+        || watch_fd(epoll_fd, signal_fd, EVENT_CHILD) == -1
+        || watch_fd(epoll_fd, slice_timer_fd, EVENT_SLICE) == -1
+        || watch_fd(epoll_fd, timer_wheel_fd, EVENT_TIMER) == -1
+        || (adaptive_admission && watch_fd(epoll_fd, admission_timer_fd, EVENT_ADMISSION) == -1)) {
+        fprintf(stderr, "unable to set up the event loop\n");
+        exit(EXIT_FAILURE);
+    }
+    // in ring mode the pipe still tells us when the terminal goes away
+    if (terminal_ring != NULL && watch_fd(epoll_fd, terminal_ring->doorbell_fd, EVENT_RING) == -1) {
+        fprintf(stderr, "unable to watch the command ring\n");
+        exit(EXIT_FAILURE);
+    }
+    if (journal_path != NULL) {
+        start_journal();
+        end_reply();
+    }
+
+    // block until a command arrives or a child exits, an idle manager never wakes up
     while (true) {
-        char buffer[100];
-        ssize_t bytes_read = read(reading_pipe, buffer, 100);
-
-        if (bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            char* args[10];
-            process_input(buffer, args, 10);
-            char* cmd = args[0];
-
-            if (strcmp(cmd, "kill") == 0) {
-                perform_kill(&args[1]);
-            } else if (strcmp(cmd, "run") == 0) {
-                perform_run(&args[1]);
-            } else if (strcmp(cmd, "list") == 0) {
-                perform_list();
-            } else if (strcmp(cmd, "resume") == 0) {
-                perform_resume(&args[1]);
-            } else if (strcmp(cmd, "stop") == 0) {
-                perform_stop(&args[1]);
-            } else if (strcmp(cmd, "exit") == 0) {
-                perform_exit();
+        // the terminal only rings the ring's doorbell once we have said we are going to sleep
+        const bool sleeping = terminal_ring == NULL || ring_prepare_sleep(terminal_ring);
+        struct epoll_event events[MAX_EVENTS];
+        const int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, sleeping ? -1 : 0);
+        loop_wake_ns = monotonic_ns();
+        if (terminal_ring != NULL) {
+            atomic_store(&terminal_ring->consumer_sleeping, 0);
+            drain_command_ring();
+        }
+        if (ready == -1) {
+            continue;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            switch ((enum event_source)(events[i].data.u64 & UINT32_MAX)) {
+            case EVENT_CLIENT:
+                handle_client((size_t)(events[i].data.u64 >> 32), events[i].events);
+                break;
+            case EVENT_LISTEN:
+                handle_listen();
+                break;
+            case EVENT_OUTPUT:
+                handle_output((size_t)(events[i].data.u64 >> 32));
+                break;
+            case EVENT_CHILD:
+                handle_child_signal(signal_fd);
+                break;
+            case EVENT_SLICE:
+                handle_slice_timer();
+                break;
+            case EVENT_RING:
+                handle_ring_doorbell();
+                break;
+            case EVENT_ADMISSION:
+                handle_admission_timer();
+                break;
+            case EVENT_ADOPTED:
+                handle_adopted((size_t)(events[i].data.u64 >> 32));
+                break;
+            case EVENT_TIMER:
+                handle_timer_wheel();
                 break;
             }
-
-            fflush(stdout);
         }
-
-        process_tracker();
-        //sleep to reduce CPU utilisation
-        usleep(100000);
+        // whatever jobs did in the meantime goes out as one notification
+        end_reply();
+        flush_watch();
+        arm_slice_timer();
+        journal_sync();
     }
 }
 
@@ -529,16 +4850,120 @@ void run_process_manager(int reading_pipe)
  * Entry point
  ******************************************************************************/
 
-int main(void)
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && strcmp(argv[0], hold_argv0) == 0) {
+        return hold_and_exec(&argv[1]);
+    }
+
+    // -j N runs up to N jobs at once, one per cpu when not given
+    // -q MS time slices running jobs round robin with an MS millisecond quantum
+    // -r sends commands over a shared memory ring instead of the pipe
+    // -s PATH also takes commands from any number of clients connecting to a unix socket at PATH;
+    //    the terminal then keeps the manager running past the end of its input
+    // -b FILE runs the commands in FILE, - for stdin, without prompting
+    // -l DIR captures each job's stdout and stderr in DIR/<pid>.log instead of sharing ours
+    // -g MS gives jobs MS milliseconds to exit after SIGTERM when the manager exits or a run limit runs out
+    // -m schedules each priority as a multi-level feedback queue, -q then sets the top level's quantum
+    // -a N lets admission control run anywhere from 1 to N jobs as cpu and memory pressure allow
+    // -J FILE journals the jobs to FILE, a manager started on it again takes over the jobs it lists
+    // -e runs jobs with earlier run --deadline first within a priority, those without one last
+    int running_limit = 0;
+    int quantum = 0;
+    bool use_ring = false;
+    bool usage = false;
+    int input_fd = STDIN_FILENO;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:eg:j:J:l:mq:rs:")) != -1) {
+        switch (opt) {
+        case 'J':
+            journal_path = optarg;
+            break;
+        case 'a':
+            adaptive_admission = true;
+            usage |= !parse_int(optarg, &admission_limit) || admission_limit <= 0
+                || admission_limit > MAX_RUNNING_LIMIT;
+            break;
+        case 'm':
+            mlfq = true;
+            break;
+        case 'e':
+            edf = true;
+            break;
+        case 'g':
+            shutdown_grace_ms = atol(optarg);
+            usage |= shutdown_grace_ms < 0;
+            break;
+        case 'l':
+            log_dir = optarg;
+            break;
+        case 'b':
+            batch_mode = true;
+            if (strcmp(optarg, "-") != 0 && (input_fd = open(optarg, O_RDONLY | O_CLOEXEC)) == -1) {
+                fprintf(stderr, "unable to open %s: %s\n", optarg, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            use_ring = true;
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'j':
+            usage |= !parse_int(optarg, &running_limit) || running_limit <= 0 || running_limit > MAX_RUNNING_LIMIT;
+            break;
+        case 'q':
+            usage |= !parse_int(optarg, &quantum) || quantum <= 0 || quantum > MAX_QUANTUM_MS;
+            quantum_ms = quantum;
+            break;
+        default:
+            usage = true;
+            break;
+        }
+    }
+    if (mlfq && quantum_ms == 0) {
+        quantum_ms = MLFQ_DEFAULT_QUANTUM_MS;
+    }
+    if (usage) {
+        fprintf(stderr, "usage: %s [-a max_running] [-b script] [-e] [-g grace_ms] [-j max_running] [-J journal] [-l log_dir] [-m] [-q quantum_ms] [-r] [-s socket_path]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (log_dir != NULL && mkdir(log_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "unable to create %s: %s\n", log_dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (log_dir != NULL && (discard_fd = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1) {
+        fprintf(stderr, "unable to open /dev/null\n");
+        return EXIT_FAILURE;
+    }
+    // bound before the fork so clients can connect as soon as we are running
+    const int socket_fd = socket_path != NULL ? create_listen_socket(socket_path) : -1;
+    if (socket_path != NULL && socket_fd == -1) {
+        fprintf(stderr, "unable to listen on %s: %s\n", socket_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // commands go down one pipe, replies come back up the other; jobs inherit neither
     int p[2];
-    if (pipe(p)) {
+    int r[2];
+    if (pipe2(p, O_CLOEXEC) || pipe2(r, O_CLOEXEC)) {
+        return EXIT_FAILURE;
+    }
+    command_ring* ring = NULL;
+    if (use_ring && (ring = create_command_ring()) == NULL) {
+        fprintf(stderr, "unable to create the command ring\n");
         return EXIT_FAILURE;
     }
     int reading_pipe = p[0];
     int writing_pipe = p[1];
-    fcntl(p[0], F_SETFL, O_NONBLOCK);
-    fcntl(p[1], F_SETFL, O_NONBLOCK);
+    int reading_replies = r[0];
+    int writing_replies = r[1];
+    // the manager never blocks on the terminal in either direction, the terminal blocks on the manager
+    fcntl(reading_pipe, F_SETFL, O_NONBLOCK);
+    fcntl(writing_replies, F_SETFL, O_NONBLOCK);
+    // a closed reply pipe shows up as EPIPE instead of killing the manager
+    signal(SIGPIPE, SIG_IGN);
 
     // create a pipe for the parent process (terminal) to send information
     // (buffer data) to child process (process manager)
@@ -550,14 +4975,24 @@ int main(void)
     } else if (child_pid != 0) {
         // Parent
         close(reading_pipe);
-        run_terminal(writing_pipe);
+        close(writing_replies);
+        if (socket_fd != -1) {
+            close(socket_fd);
+        }
+        run_terminal(input_fd, writing_pipe, reading_replies, ring, socket_fd == -1);
         close(writing_pipe);
+        close(reading_replies);
         return EXIT_SUCCESS;
     } else {
         // Child
+        if (input_fd != STDIN_FILENO) {
+            close(input_fd);
+        }
         close(writing_pipe);
-        run_process_manager(reading_pipe);
+        close(reading_replies);
+        run_process_manager(reading_pipe, writing_replies, running_limit, ring, socket_fd);
         close(reading_pipe);
+        close(writing_replies);
         return EXIT_SUCCESS;
     }
 }
\ No newline at end of file
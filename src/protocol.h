@@ -0,0 +1,155 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// wire format spoken between the process manager and anything driving it:
+// its own terminal over a pipe or the shared ring, and clients on its unix socket
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+typedef enum command_opcode {
+    OP_RUN = 1,
+    OP_KILL = 2,
+    OP_STOP = 3,
+    OP_RESUME = 4,
+    OP_LIST = 5,
+    OP_PRIORITY = 6,
+    OP_QUANTUM = 7,
+    OP_LIMIT = 8,
+    OP_EXIT = 9,
+    OP_STATS = 10,
+    OP_METRICS = 11,
+    OP_TRACE = 12,
+    OP_LOGS = 13,
+    OP_TAIL = 14,
+    OP_WATCH = 15,
+    OP_GROUP = 16
+} command_opcode;
+
+// one command: this header followed by argc NUL-terminated strings
+typedef struct command_header {
+    uint32_t length; // whole message, header included
+    uint32_t request_id; // picked by the sender, echoed back in the reply
+    uint16_t opcode;
+    uint16_t argc;
+    int32_t pid; // target of kill/stop/resume/priority, 0 otherwise
+} command_header;
+
+typedef enum reply_status {
+    REPLY_OK = 0,
+    REPLY_FAILED = 1
+} reply_status;
+
+// one reply: this header followed by NUL-terminated human readable text
+typedef struct reply_header {
+    uint32_t length; // whole message, header included
+    uint32_t request_id; // command this answers, 0 for notifications such as child exits
+    int32_t status; // reply_status
+    int32_t pid; // job the command created or acted on, 0 if none
+} reply_header;
+
+// a command the manager accepts and how it goes on the wire
+typedef struct command_name {
+    const char* name;
+    command_opcode opcode;
+    bool takes_pid; // first argument is encoded into command_header.pid
+} command_name;
+
+enum {
+    MAX_COMMAND_SIZE = 1 << 19
+};
+
+static const command_name command_names[] = {
+    { "run", OP_RUN, false },
+    { "kill", OP_KILL, true },
+    { "stop", OP_STOP, true },
+    { "resume", OP_RESUME, true },
+    { "list", OP_LIST, false },
+    { "stats", OP_STATS, true },
+    { "metrics", OP_METRICS, false },
+    { "trace", OP_TRACE, false },
+    { "logs", OP_LOGS, true },
+    { "tail", OP_TAIL, true },
+    { "watch", OP_WATCH, false },
+    { "priority", OP_PRIORITY, true },
+    { "quantum", OP_QUANTUM, false },
+    { "limit", OP_LIMIT, false },
+    { "group", OP_GROUP, false },
+    { "exit", OP_EXIT, false }
+};
+
+static inline const command_name* find_command(const char* name)
+{
+    for (size_t i = 0; i < sizeof(command_names) / sizeof(command_names[0]); i++) {
+        if (strcmp(command_names[i].name, name) == 0) {
+            return &command_names[i];
+        }
+    }
+    return NULL;
+}
+
+// encodes words into buffer as one message, returns its length or 0 if it would be too big
+static inline uint32_t encode_command(const command_name* command, uint32_t request_id, char* words[], int count, char** buffer, size_t* capacity)
+{
+    int first = 1;
+    command_header header;
+    memset(&header, 0, sizeof(header));
+    header.request_id = request_id;
+    header.opcode = (uint16_t)command->opcode;
+    if (command->takes_pid && count > 1) {
+        header.pid = atoi(words[1]);
+        first = 2;
+    }
+
+    size_t length = sizeof(header);
+    for (int i = first; i < count; i++) {
+        length += strlen(words[i]) + 1;
+    }
+    if (length > MAX_COMMAND_SIZE || count - first > UINT16_MAX) {
+        return 0;
+    }
+    if (length > *capacity) {
+        *capacity = length * 2;
+        *buffer = (char*)realloc(*buffer, *capacity);
+        if (*buffer == NULL) {
+            fprintf(stderr, "unable to grow the command buffer\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    header.length = (uint32_t)length;
+    header.argc = (uint16_t)(count - first);
+    memcpy(*buffer, &header, sizeof(header));
+    char* out = *buffer + sizeof(header);
+    for (int i = first; i < count; i++) {
+        const size_t size = strlen(words[i]) + 1;
+        memcpy(out, words[i], size);
+        out += size;
+    }
+    return header.length;
+}
+
+// blocking write of a whole message, false once the other end is gone
+static inline bool write_all(int fd, const char* message, size_t length)
+{
+    while (length > 0) {
+        const ssize_t written = write(fd, message, length);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        message += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+#endif